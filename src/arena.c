@@ -0,0 +1,145 @@
+/** \file arena.c
+
+    OgdlArena: memory that is bump-allocated from large chunks and
+    released all at once with OgdlArena_reset() or OgdlArena_free().
+    Graphs built in an arena (Graph_newIn(), OgdlParser_setArena()) do
+    not need Graph_free().
+
+    An arena is not locked: use one per thread.
+*/
+
+#include "ogdl.h"
+
+#define ARENA_CHUNK 65536
+#define ARENA_ALIGN (sizeof(void *))
+
+struct _OgdlArenaChunk {
+    struct _OgdlArenaChunk *next;   /* the chunk allocated before this one */
+    size_t size;                    /* bytes after the header */
+};
+
+#define HEADER ((sizeof(struct _OgdlArenaChunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static struct _OgdlArenaChunk * chunk_new(size_t size)
+{
+    struct _OgdlArenaChunk *c;
+
+    c = malloc(HEADER + size);
+    if (!c) return 0;
+    c->next = 0;
+    c->size = size;
+    return c;
+}
+
+/** Arena constructor. chunk_size is the size of the blocks requested
+    from malloc(); 0 means the default (64 KB).
+ */
+
+OgdlArena OgdlArena_new (size_t chunk_size)
+{
+    OgdlArena a;
+
+    a = malloc(sizeof(*a));
+    if (!a) return 0;
+
+    a->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK;
+    a->chunk = chunk_new(a->chunk_size);
+    if (!a->chunk) {
+        free(a);
+        return 0;
+    }
+    a->pos = (char *) a->chunk + HEADER;
+    a->end = a->pos + a->chunk_size;
+    a->renames = 0;
+    a->edits = 0;
+
+    return a;
+}
+
+/** Returns size bytes, aligned for any of the structures of this
+    library, or NULL if malloc() fails.
+ */
+
+void * OgdlArena_alloc (OgdlArena a, size_t size)
+{
+    struct _OgdlArenaChunk *c;
+    char *s;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (size <= (size_t) (a->end - a->pos)) {
+        s = a->pos;
+        a->pos += size;
+        return s;
+    }
+
+    /* a large block gets a chunk of its own, behind the current one */
+    if (size > a->chunk_size / 4) {
+        c = chunk_new(size);
+        if (!c) return 0;
+        c->next = a->chunk->next;
+        a->chunk->next = c;
+        return (char *) c + HEADER;
+    }
+
+    c = chunk_new(a->chunk_size);
+    if (!c) return 0;
+    c->next = a->chunk;
+    a->chunk = c;
+    a->pos = (char *) c + HEADER + size;
+    a->end = (char *) c + HEADER + a->chunk_size;
+    return (char *) c + HEADER;
+}
+
+/** Copies len bytes of s into the arena and adds a NUL */
+
+char * OgdlArena_strdup (OgdlArena a, const char *s, size_t len)
+{
+    char *t;
+
+    t = OgdlArena_alloc(a,len+1);
+    if (!t) return 0;
+    memcpy(t,s,len);
+    t[len] = 0;
+    return t;
+}
+
+/** Releases everything allocated from the arena, keeping one chunk
+    for the next use. Graphs built in it are no longer valid.
+ */
+
+void OgdlArena_reset (OgdlArena a)
+{
+    struct _OgdlArenaChunk *c, *next, *keep = 0;
+
+    if (!a) return;
+
+    /* blocks that got a chunk of their own have other sizes; the first
+       chunk is always of chunk_size bytes */
+    for (c = a->chunk; c; c = next) {
+        next = c->next;
+        if (!keep && c->size == a->chunk_size)
+            keep = c;
+        else
+            free(c);
+    }
+    keep->next = 0;
+    a->chunk = keep;
+    a->pos = (char *) keep + HEADER;
+    a->end = a->pos + a->chunk_size;
+}
+
+/** Arena destructor */
+
+void OgdlArena_free (OgdlArena a)
+{
+    struct _OgdlArenaChunk *c, *next;
+
+    if (!a) return;
+
+    for (c = a->chunk; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    free(a);
+}
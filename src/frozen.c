@@ -0,0 +1,357 @@
+/** \file frozen.c
+
+    FrozenGraph: an immutable copy of a Graph in one array of nodes in
+    preorder, with the names in one string pool. The subnodes of a node
+    follow it: the first one is at first, the others are chained by
+    next, and a whole subtree takes subtree entries.
+
+    Nodes are referred to by their index in the array, 0 being the root.
+    Functions that look for a node return -1 if it is not found.
+
+    A FrozenGraph is not modified after Graph_freeze(), so it can be
+    read from several threads.
+*/
+
+#include "ogdl.h"
+
+#define INDEX_MIN 32    /* subnodes of wider nodes go in the name hash */
+
+struct _Freezer {
+    FrozenGraph f;
+    int  n;             /* nodes added */
+    long *names;        /* string pool offsets by hash, to share names */
+    int  names_size;
+    int  names_count;
+};
+
+static int count(Graph g)
+{
+    int i, n = 1;
+
+    for (i=0; i<g->size; i++)
+        n += count(g->nodes[i]);
+    return n;
+}
+
+static long poolSize(Graph g)
+{
+    long n = Graph_len(g) + 1;
+    int i;
+
+    for (i=0; i<g->size; i++)
+        n += poolSize(g->nodes[i]);
+    return n;
+}
+
+/* the offset in the pool of a copy of s: names up to SYMBOL_MAX long are
+   stored once, but for binary ones */
+
+static long pool(struct _Freezer *z, const char *s, int len, int binary)
+{
+    FrozenGraph f = z->f;
+    unsigned long h;
+    long *e, off, *old;
+    int i, k, n;
+
+    if (len > SYMBOL_MAX || binary) {
+        off = f->pool_len;
+        memcpy(f->pool + off,s,len+1);
+        f->pool_len += len+1;
+        return off;
+    }
+
+    if (z->names_count * 2 >= z->names_size) {
+        old = z->names;
+        n = z->names_size;
+        z->names_size = n ? n*2 : 1024;
+        z->names = malloc(z->names_size * sizeof(long));
+        if (!z->names) {
+            z->names = old;
+            z->names_size = n;
+            return -1;
+        }
+        for (i=0; i<z->names_size; i++)
+            z->names[i] = -1;
+        for (i=0; i<n; i++) {
+            if (old[i] < 0) continue;
+            h = OgdlSymtab_hash(f->pool + old[i],strlen(f->pool + old[i]));
+            for (k = h & (z->names_size-1); z->names[k] >= 0; k = (k+1) & (z->names_size-1))
+                ;
+            z->names[k] = old[i];
+        }
+        free(old);
+    }
+
+    h = OgdlSymtab_hash(s,len);
+    for (k = h & (z->names_size-1); ; k = (k+1) & (z->names_size-1)) {
+        e = z->names + k;
+        if (*e < 0)
+            break;
+        if (!strcmp(f->pool + *e,s))
+            return *e;
+    }
+
+    off = f->pool_len;
+    memcpy(f->pool + off,s,len+1);
+    f->pool_len += len+1;
+    *e = off;
+    z->names_count++;
+    return off;
+}
+
+static int freeze(struct _Freezer *z, Graph g, int parent)
+{
+    FrozenNode *x;
+    int i, me = z->n++, prev = -1, c;
+
+    x = z->f->nodes + me;
+    x->len = Graph_len(g);
+    x->name = pool(z,g->name,x->len,g->flags & GRAPH_BINARY);
+    if (x->name < 0) return -1;
+    x->size = g->size;
+    x->parent = parent;
+    x->first = g->size ? me+1 : -1;
+    x->next = -1;
+
+    for (i=0; i<g->size; i++) {
+        c = z->n;
+        if (freeze(z,g->nodes[i],me) < 0) return -1;
+        if (prev >= 0)
+            z->f->nodes[prev].next = c;
+        prev = c;
+    }
+
+    z->f->nodes[me].subtree = z->n - me;
+    return 0;
+}
+
+static unsigned long key(int parent, const char *s, int len)
+{
+    return OgdlSymtab_hash(s,len) ^ ((unsigned long) parent * 0x9e3779b1UL);
+}
+
+/* the subnodes of wide nodes, by (parent, name); only the first node
+   with a name is there */
+
+static int hashNodes(FrozenGraph f)
+{
+    FrozenNode *x;
+    int i, k, n = 0, size = 64;
+
+    for (i=0; i<f->count; i++)
+        if (f->nodes[i].parent >= 0 && f->nodes[f->nodes[i].parent].size >= INDEX_MIN)
+            n++;
+    if (!n) return 0;
+
+    while (size < n*2)
+        size *= 2;
+    f->hash = malloc(size * sizeof(int));
+    if (!f->hash) return ERROR_malloc;
+    f->hash_size = size;
+    for (k=0; k<size; k++)
+        f->hash[k] = -1;
+
+    for (i=0; i<f->count; i++) {
+        x = f->nodes + i;
+        if (x->parent < 0 || f->nodes[x->parent].size < INDEX_MIN)
+            continue;
+        for (k = key(x->parent,f->pool + x->name,x->len) & (size-1); f->hash[k] >= 0; k = (k+1) & (size-1))
+            if (f->nodes[f->hash[k]].parent == x->parent
+                && f->nodes[f->hash[k]].len == x->len
+                && !memcmp(f->pool + f->nodes[f->hash[k]].name,f->pool + x->name,x->len))
+                break;
+        if (f->hash[k] < 0)
+            f->hash[k] = i;
+    }
+    return 0;
+}
+
+/** Makes a FrozenGraph out of g, which is not changed. */
+
+FrozenGraph Graph_freeze (Graph g)
+{
+    struct _Freezer z;
+    FrozenGraph f;
+
+    if (!g) return 0;
+
+    f = malloc(sizeof(*f));
+    if (!f) return 0;
+
+    f->count = count(g);
+    f->nodes = malloc(f->count * sizeof(FrozenNode));
+    f->pool = malloc(poolSize(g));
+    f->pool_len = 0;
+    f->hash = 0;
+    f->hash_size = 0;
+
+    z.f = f;
+    z.n = 0;
+    z.names = 0;
+    z.names_size = z.names_count = 0;
+
+    if (!f->nodes || !f->pool || freeze(&z,g,-1) || hashNodes(f)) {
+        free(z.names);
+        FrozenGraph_free(f);
+        return 0;
+    }
+    free(z.names);
+
+    /* give back what sharing the names saved */
+    if (f->pool_len) {
+        char *s = realloc(f->pool,f->pool_len);
+        if (s) f->pool = s;
+    }
+
+    return f;
+}
+
+/** Makes a Graph out of the subtree of node n of f */
+
+Graph Graph_thaw (FrozenGraph f, int n)
+{
+    Graph *g, root;
+    char *s;
+    int i, end, len;
+
+    if (!f || n < 0 || n >= f->count) return 0;
+
+    end = n + f->nodes[n].subtree;
+    g = malloc((end - n) * sizeof(Graph));
+    if (!g) return 0;
+
+    /* in preorder the parent of a node comes before it; names that
+       Graph_newLen() does not take (empty, long, with 0s) were binary */
+    for (i=n; i<end; i++) {
+        s = f->pool + f->nodes[i].name;
+        len = f->nodes[i].len;
+        g[i-n] = (!len || len > BUFFER || memchr(s,0,len)) ? Graph_newBytes(s,len)
+                                                      : Graph_newLen(s,len);
+        if (i > n)
+            Graph_addNode(g[f->nodes[i].parent - n],g[i-n]);
+    }
+
+    root = g[0];
+    free(g);
+    return root;
+}
+
+/** FrozenGraph destructor */
+
+void FrozenGraph_free (FrozenGraph f)
+{
+    if (!f) return;
+
+    free(f->nodes);
+    free(f->pool);
+    free(f->hash);
+    free(f);
+}
+
+/** Return the name of node n */
+
+char * FrozenGraph_getName (FrozenGraph f, int n)
+{
+    if (!f || n < 0 || n >= f->count) return 0;
+    return f->pool + f->nodes[n].name;
+}
+
+/** Return the number of subnodes of node n */
+
+int FrozenGraph_size (FrozenGraph f, int n)
+{
+    if (!f || n < 0 || n >= f->count) return 0;
+    return f->nodes[n].size;
+}
+
+/** Return the i-th subnode of node n */
+
+int FrozenGraph_getByIndex (FrozenGraph f, int n, int i)
+{
+    int c;
+
+    if (!f || n < 0 || n >= f->count || i < 0 || i >= f->nodes[n].size)
+        return -1;
+
+    /* subtree sizes let us jump over the subnodes before it */
+    for (c = f->nodes[n].first; i--; c += f->nodes[c].subtree)
+        ;
+    return c;
+}
+
+/* the k-th subnode of n named name (k = 0: the first) */
+
+static int nthNode(FrozenGraph f, int n, const char *name, int len, int k)
+{
+    FrozenNode *x;
+    int c, h;
+
+    if (k < 0) return -1;
+
+    c = f->nodes[n].first;
+
+    if (f->nodes[n].size >= INDEX_MIN && f->hash) {
+        for (h = key(n,name,len) & (f->hash_size-1); ; h = (h+1) & (f->hash_size-1)) {
+            c = f->hash[h];
+            if (c < 0) return -1;
+            if (f->nodes[c].parent == n && f->nodes[c].len == len
+                && !memcmp(f->pool + f->nodes[c].name,name,len))
+                break;
+        }
+    }
+
+    for (; c >= 0; c = x->next) {
+        x = f->nodes + c;
+        if (x->len == len && !memcmp(f->pool + x->name,name,len) && !k--)
+            return c;
+    }
+    return -1;
+}
+
+/** Return the first subnode of node n with the given name */
+
+int FrozenGraph_getNode (FrozenGraph f, int n, char *name)
+{
+    if (!f || !name || n < 0 || n >= f->count) return -1;
+    return nthNode(f,n,name,strlen(name),0);
+}
+
+/** Returns the subnode of node n that a step of a compiled path gives
+    (name, name[n] or .[n]), or -1.
+ */
+
+int FrozenGraph_getStep (FrozenGraph f, int n, OgdlPathStep *s)
+{
+    if (!f || !s || n < 0 || n >= f->count) return -1;
+
+    switch (s->type) {
+    case PATH_INDEX:
+        return FrozenGraph_getByIndex(f,n,s->n);
+    case PATH_NAME:
+    case PATH_NTH:
+        return nthNode(f,n,s->name,s->len,s->n);
+    default:
+        return -1;
+    }
+}
+
+/** Returns the node that matches the given path from node n, as
+    Graph_get() does (but x[] is not supported), or -1.
+ */
+
+int FrozenGraph_get (FrozenGraph f, int n, char *path)
+{
+    OgdlPath p;
+    int k;
+
+    if (!f || n < 0 || n >= f->count) return -1;
+
+    if (!(p = OgdlPath_compile(path)))
+        return -1;
+
+    for (k=0; n >= 0 && k<p->nsteps; k++)
+        n = FrozenGraph_getStep(f,n,p->steps + k);
+
+    OgdlPath_free(p);
+    return n;
+}
@@ -2,9 +2,69 @@
 */
 
 #include "ogdl.h"
+#include <limits.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #define CHUNK 16
 #define MAXSTRING 65534
+#define INDEX_MIN 32    /* nodes with this many subnodes get a GraphIndex */
+#define PATH_BUFFER 1024    /* Graph_get() compiles shorter paths on the stack */
+#define GETMANY_SCAN 32     /* Graph_getMany() scans for up to this many names */
+
+/* GraphIndex: the subnodes of a node by name, in a hash table with one
+   slot per distinct name. The nodes with the same name are chained in
+   order, so the first one and the nth one can be found. */
+
+#define SLOT_FREE -1    /* slot never used: lookups stop here */
+#define SLOT_GONE -2    /* its nodes were renamed: lookups go on */
+
+struct _GraphIndexSlot {
+    unsigned long hash;
+    int first;          /* first subnode with this name, or SLOT_* */
+    int last;
+};
+
+struct _GraphIndex {
+    struct _GraphIndexSlot *slots;
+    int *next;          /* next[i]: the next subnode named as nodes[i], or -1 */
+    int size;           /* number of slots, a power of 2 */
+    int count;          /* used slots */
+    int n;              /* nodes[0..n) are indexed */
+    int next_max;
+    OgdlArena arena;    /* of its subnodes in an arena, if any */
+    unsigned long epoch;    /* arena->renames when built */
+};
+
+/* the references of shared nodes (see Graph_snapshot()) are dropped by
+   whichever thread frees a snapshot */
+
+#if defined(__GNUC__)
+#define REFS(g)    __atomic_load_n(&(g)->refs,__ATOMIC_ACQUIRE)
+#define REF_INC(g) __atomic_fetch_add(&(g)->refs,1,__ATOMIC_RELAXED)
+#define REF_DEC(g) __atomic_fetch_sub(&(g)->refs,1,__ATOMIC_ACQ_REL)
+#define HASH(g)    __atomic_load_n(&(g)->hash,__ATOMIC_ACQUIRE)
+#define HASH_EPOCH(g) __atomic_load_n(&(g)->hash_epoch,__ATOMIC_RELAXED)
+#define SET_HASH(g,h,e) (__atomic_store_n(&(g)->hash_epoch,e,__ATOMIC_RELAXED), \
+                         __atomic_store_n(&(g)->hash,h,__ATOMIC_RELEASE))
+#define EDITS(a)   __atomic_load_n(&(a)->edits,__ATOMIC_ACQUIRE)
+#define EDITED(a)  __atomic_fetch_add(&(a)->edits,1,__ATOMIC_RELEASE)
+#define RENAMES(a) __atomic_load_n(&(a)->renames,__ATOMIC_ACQUIRE)
+#define RENAMED(a) __atomic_fetch_add(&(a)->renames,1,__ATOMIC_RELEASE)
+#else
+#define REFS(g)    ((g)->refs)
+#define REF_INC(g) ((g)->refs++)
+#define REF_DEC(g) ((g)->refs--)
+#define HASH(g)    ((g)->hash)
+#define HASH_EPOCH(g) ((g)->hash_epoch)
+#define SET_HASH(g,h,e) ((g)->hash_epoch = (e), (g)->hash = (h))
+#define EDITS(a)   ((a)->edits)
+#define EDITED(a)  ((a)->edits++)
+#define RENAMES(a) ((a)->renames)
+#define RENAMED(a) ((a)->renames++)
+#endif
 
 static void fatal(char *s)
 {
@@ -23,14 +83,33 @@ static void error(char *s)
  */
 
 Graph Graph_new (char *name)
+{
+    if (!name) {
+        error("argument is null");
+	return 0;
+    }
+    
+    return Graph_newLen(name,strlen(name));
+}
+
+/** Graph constructor for a name of known length: len bytes of name
+    are copied, name does not need to be NUL terminated.
+ */
+
+Graph Graph_newLen (char *name, int len)
 {
     Graph g;
-    int i;
 
     if (!name) {
         error("argument is null");
 	return 0;
     }
+
+    /* limit string lengths */
+    if (len>MAXSTRING || len<=0) {
+	error("string too long or empty");
+        return 0;
+    }
     
     g = (void *) malloc (sizeof(*g));
     if (!g) {
@@ -41,26 +120,203 @@ Graph Graph_new (char *name)
     g->size = 0;
     g->type = 0;
     g->nodes = 0;
-
-    /* limit string lengths */
-    i = strlen(name);
-    if (i>MAXSTRING || !i) {
+    g->index = 0;
+    g->flags = 0;
+    g->refs = 0;
+    g->store = 0;
+    g->hash = 0;
+    g->hash_epoch = 0;
+
+    g->name = malloc(len+1);
+    if (!g->name) {
+        error("malloc error");
         free (g);
-	error("string too long or empty");
         return 0;
     }
+    memcpy(g->name,name,len);
+    g->name[len]=0;
+
+    return g;
+}
+
+/** Graph constructor that does not copy the name: the node points to
+    the given string, which must outlive it and is not freed with it.
+ */
+
+Graph Graph_newRef (char *name)
+{
+    Graph g;
+
+    if (!name || !*name) {
+        error("argument is null or empty");
+        return 0;
+    }
+
+    g = (void *) malloc (sizeof(*g));
+    if (!g) {
+        error("malloc error");
+        return 0;
+    }
+
+    g->name = name;
+    g->size = 0;
+    g->type = 0;
+    g->nodes = 0;
+    g->index = 0;
+    g->flags = GRAPH_NAME_REF;
+    g->refs = 0;
+    g->store = 0;
+    g->hash = 0;
+    g->hash_epoch = 0;
+
+    return g;
+}
+
+/** Graph constructor for a value of len bytes, that can hold 0s (a
+    blob): they are copied, with a 0 after them. Graph_getBytes() and
+    Graph_len() give them back; as a C string the name ends at the first
+    0. Paths match such a node if its bytes are the name in the path.
+ */
+
+Graph Graph_newBytes (const void *bytes, int len)
+{
+    Graph g;
+
+    if ((!bytes && len) || len < 0) {
+        error("argument is null or out of range");
+        return 0;
+    }
+
+    g = (void *) malloc (sizeof(*g));
+    if (!g) {
+        error("malloc error");
+        return 0;
+    }
+
+    g->name = malloc(len+1);
+    if (!g->name) {
+        free(g);
+        error("malloc error");
+        return 0;
+    }
+    if (len)
+        memcpy(g->name,bytes,len);
+    g->name[len] = 0;
+
+    g->len = len;
+    g->size = 0;
+    g->type = 0;
+    g->nodes = 0;
+    g->index = 0;
+    g->flags = GRAPH_BINARY;
+    g->refs = 0;
+    g->store = 0;
+    g->hash = 0;
+    g->hash_epoch = 0;
+
+    return g;
+}
+
+/** Graph constructor in an arena: the node, its name and its array
+    of subnodes are allocated from a, and released with it (by
+    OgdlArena_reset() or OgdlArena_free()), not by Graph_free().
+ */
+
+Graph Graph_newIn (OgdlArena a, char *name)
+{
+    if (!name) {
+        error("argument is null");
+	return 0;
+    }
     
-    if (name) {
-        g->name = malloc(i+1);
-        if (!g->name) {
-	    error("malloc error");
-	    free (g);
-	    return 0;
-	}
-        strncpy(g->name,name,i);
-	g->name[i]=0;
+    return Graph_newLenIn(a,name,strlen(name));
+}
+
+/** Graph_newIn() for a name of known length (see Graph_newLen()) */
+
+Graph Graph_newLenIn (OgdlArena a, char *name, int len)
+{
+    Graph g;
+
+    if (!a || !name) {
+        error("argument is null");
+	return 0;
+    }
+
+    if (len>MAXSTRING || len<=0) {
+	error("string too long or empty");
+        return 0;
+    }
+
+    g = OgdlArena_alloc(a,sizeof(*g));
+    if (!g) {
+        error("malloc error");
+        return 0;
+    }
+
+    g->name = OgdlArena_strdup(a,name,len);
+    if (!g->name) {
+        error("malloc error");
+        return 0;
+    }
+
+    g->size = 0;
+    g->size_max = 0;
+    g->type = 0;
+    g->nodes = 0;
+    g->index = 0;
+    g->flags = GRAPH_ARENA | GRAPH_NAME_REF;
+    g->refs = 0;
+    g->store = a;
+    g->hash = 0;
+    g->hash_epoch = 0;
+
+    return g;
+}
+
+/** Graph constructor with an interned name: the name is the copy of
+    the len bytes at name in t, shared by all the nodes with that name.
+    The node is in arena a, if not NULL. Names longer than SYMBOL_MAX
+    are not interned (the node gets a copy, as with Graph_newLen()).
+ */
+
+Graph Graph_newSym (OgdlSymtab t, OgdlArena a, char *name, int len)
+{
+    Graph g;
+    char *s;
+
+    if (!t || len > SYMBOL_MAX)
+        return a ? Graph_newLenIn(a,name,len) : Graph_newLen(name,len);
+
+    if (!name || len <= 0) {
+	error("argument is null or empty");
+        return 0;
+    }
+
+    s = OgdlSymtab_intern(t,name,len);
+    if (!s) {
+        error("malloc error");
+        return 0;
+    }
+
+    g = a ? OgdlArena_alloc(a,sizeof(*g)) : malloc(sizeof(*g));
+    if (!g) {
+        error("malloc error");
+        return 0;
     }
 
+    g->name = s;
+    g->size = 0;
+    g->size_max = 0;
+    g->type = 0;
+    g->nodes = 0;
+    g->index = 0;
+    g->flags = GRAPH_NAME_REF | GRAPH_INTERNED | (a ? GRAPH_ARENA : 0);
+    g->refs = 0;
+    g->store = a;
+    g->hash = 0;
+    g->hash_epoch = 0;
+
     return g;
 }
 
@@ -98,16 +354,179 @@ char * Graph_getName(Graph g)
     return g->name;
 }
 
+/** Returns the length of the name of g: that of its bytes for a node
+    made with Graph_newBytes() or Graph_setBytes().
+ */
+
+int Graph_len (Graph g)
+{
+    if (!g) return 0;
+    return (g->flags & GRAPH_BINARY) ? g->len : (int) strlen(g->name);
+}
+
+/** Returns the name of g and its length in *len, 0s included for a
+    node made with Graph_newBytes() or Graph_setBytes().
+ */
+
+char * Graph_getBytes (Graph g, int *len)
+{
+    if (!g) return 0;
+    if (len)
+        *len = Graph_len(g);
+    return g->name;
+}
+
+/* whether a and b have the same name, all the bytes of binary ones */
+
+static int sameNames(Graph a, Graph b)
+{
+    int n;
+
+    if ((a->flags | b->flags) & GRAPH_BINARY) {
+        n = Graph_len(a);
+        return n == Graph_len(b) && !memcmp(a->name,b->name,n);
+    }
+    return a->name == b->name || !strcmp(a->name,b->name);
+}
+
+static int unshare(Graph g);
+static struct _GraphIndex * indexFresh(Graph g);
+static int indexBuild(Graph g);
+static void indexLink(Graph g, int i);
+static int indexUnlink(Graph g, Graph node);
+static void indexRelink(Graph g, int i);
+
+/* the store of a heap node, which an OgdlNames attached to it keeps
+   (see Graph_setNames()) */
+
+#define STORE(g) (((g)->flags & GRAPH_NAMES) ? ((OgdlNames) (g)->store)->store : (g)->store)
+
+/* the node g was added to, if known */
+
+static Graph parentOf(Graph g)
+{
+    if (g->flags & (GRAPH_ARENA | GRAPH_MAPPED))
+        return 0;
+    if (g->flags & GRAPH_COW)
+        return STORE((Graph) g->store);
+    return STORE(g);
+}
+
+/* a node shared by several (see Graph_snapshot(), Graph_dedup()) has
+   none: it cannot change, and it is given one again by own() once a
+   single one is left */
+
+static void setParent(Graph g, Graph parent)
+{
+    if (g->flags & (GRAPH_ARENA | GRAPH_MAPPED))
+        return;
+    if (g->flags & GRAPH_COW)
+        g = g->store;
+    if (g->flags & GRAPH_NAMES)
+        ((OgdlNames) g->store)->store = parent;
+    else
+        g->store = parent;
+}
+
+/* frees the OgdlNames attached to g, which gives back its store */
+
+static void dropNames(Graph g)
+{
+    OgdlNames x = g->store;
+
+    g->store = x->store;
+    g->flags &= ~GRAPH_NAMES;
+    OgdlNames_free(x);
+}
+
+/* forgets the hashes of g and of the nodes above it; if one has no
+   hash, neither have those above it. The parents of nodes in an arena
+   are not known: the hashes of the whole arena are forgotten, by
+   counting the change in it (see hashOf()). An OgdlNames attached to
+   one of them is dropped. */
+
+static void changed(Graph g)
+{
+    if (g && (g->flags & GRAPH_NAMES))
+        dropNames(g);
+    for (; g && g->hash; g = parentOf(g)) {
+        g->hash = 0;
+        if (g->flags & GRAPH_NAMES)
+            dropNames(g);
+        if (g->flags & GRAPH_ARENA) {
+            EDITED((OgdlArena) g->store);
+            break;
+        }
+    }
+}
+
+/* gives g a copy of the len bytes at s as its name */
+
+static int setName (Graph g, const char *s, int len, int binary)
+{
+    Graph parent;
+    int i = -1;
+    char *p;
+
+    if ((g->flags & GRAPH_COW) && unshare(g))
+        return ERROR_malloc;
+    if (REFS(g))
+        return ERROR_shared;
+	
+    if (g->flags & GRAPH_ARENA) {
+        p = OgdlArena_strdup(g->store,s,len);
+        if (!p)
+            return ERROR_malloc;
+        g->name = p;
+        g->len = len;
+        g->flags = (g->flags & ~(GRAPH_INTERNED | GRAPH_BINARY)) | GRAPH_NAME_REF | binary;
+
+        /* its parent is not known: the indexes over the arena are stale */
+        if (g->flags & GRAPH_INDEXED)
+            RENAMED((OgdlArena) g->store);
+        changed(g);
+        return 0;
+    }
+
+    p = malloc(len+1);
+    if (!p) 
+	return ERROR_malloc;
+
+    memcpy(p,s,len);
+    p[len]=0;
+
+    /* the index of the parent is mended, not rebuilt */
+    parent = (g->flags & GRAPH_INDEXED) ? parentOf(g) : 0;
+    if (parent && parent->index && indexFresh(parent))
+        i = indexUnlink(parent,g);
+
+    if (g->name && !(g->flags & GRAPH_NAME_REF)) 
+        free(g->name);
+
+    g->name = p;
+    g->len = len;
+    g->flags = (g->flags & ~(GRAPH_NAME_REF | GRAPH_INTERNED | GRAPH_BINARY)) | binary;
+
+    if (i >= 0)
+        indexRelink(parent,i);
+    changed(g);
+    return 0;
+}
+
 /** set the name of this node.
 
     A newly allocated copy of the string is
     used. Return values are non zero on error.
+    Nodes shared with a snapshot cannot be renamed (ERROR_shared):
+    see Graph_own(). The parent of a node in an arena is not known:
+    renaming an indexed one leaves the indexes over the arena to the
+    next change to those nodes or to Graph_reindex(), and lookups in
+    them scan meanwhile.
  */
 
 int Graph_setName (Graph g, char *s)
 {
     int len;
-    char *p;
         
     if (!g)
         return ERROR_noObject;
@@ -118,22 +537,30 @@ int Graph_setName (Graph g, char *s)
     len = strlen(s);
     if (len>MAXSTRING) 
         return ERROR_argumentOutOfRange;
-	
-    p = malloc(len+1);
-    if (!p) 
-	return ERROR_malloc;
 
-    strncpy(p,s,len);
-    p[len]=0;
+    return setName(g,s,len,0);
+}
 
-    if (g->name) 
-        free(g->name);
+/** Graph_setName() with len bytes, that can hold 0s (see
+    Graph_newBytes()).
+ */
 
-    g->name = p;
-    return 0;
+int Graph_setBytes (Graph g, const void *bytes, int len)
+{
+    if (!g)
+        return ERROR_noObject;
+    if (!bytes && len)
+        return ERROR_argumentIsNull;
+    if (len < 0)
+        return ERROR_argumentOutOfRange;
+
+    return setName(g,bytes,len,GRAPH_BINARY);
 }
 
-/** Graph destructor */
+/** Graph destructor. Nodes in an arena are left to it, but the
+    subnodes added to them with Graph_new() are freed. A node shared
+    with snapshots is freed with the last of them.
+ */
 
 void Graph_free (Graph g)
 {
@@ -141,16 +568,44 @@ void Graph_free (Graph g)
     
     if (!g) return;
 
+    if (REFS(g) && REF_DEC(g) > 0)
+        return;
+
+    if (g->flags & GRAPH_COW) {
+        Graph_free(g->store);
+        free(g);
+        return;
+    }
+
     if (g->nodes) {
-        for (i=0; i<g->size; i++)
-            Graph_free(g->nodes[i]);
-        free(g->nodes);
+        if (!(g->flags & GRAPH_BORROWED))
+            for (i=0; i<g->size; i++)
+                Graph_free(g->nodes[i]);
+        if (!(g->flags & GRAPH_ARENA))
+            free(g->nodes);
+    }
+
+    if (g->index && !(g->flags & GRAPH_ARENA)) {
+        free(g->index->slots);
+        free(g->index->next);
+        free(g->index);
     }
     
-    if (g->name)
+    if (g->name && !(g->flags & GRAPH_NAME_REF))
         free(g->name);
 
-    free (g);
+    if (g->flags & GRAPH_NAMES)
+        dropNames(g);
+
+#ifndef _WIN32
+    if (g->flags & GRAPH_MAPPED) {
+        munmap(((OgdlMap)g->store)->addr,((OgdlMap)g->store)->len);
+        free(g->store);
+    }
+#endif
+
+    if (!(g->flags & GRAPH_ARENA))
+        free (g);
 }
 
 /** Returns zero when the line has been 'closed', ie, a NL has been printed.
@@ -231,65 +686,298 @@ int Graph_printString(const char *s, int indent, int pending_break)
     return Graph_fprintString(stdout,s,indent,pending_break);
 }
 
-static int _fprintGraph(FILE *fp, Graph g, int level, int maxLevel, int nspaces, int pending_break)
+static int sameName(Graph node, OgdlPathStep *s, int interned);
+
+/* memory for the index of g: in its arena if it has one */
+
+static void * indexAlloc(Graph g, size_t n)
+{
+    if (g->flags & GRAPH_ARENA)
+        return OgdlArena_alloc(g->store,n);
+    return malloc(n);
+}
+
+static void indexFree(Graph g, void *p)
 {
-    int i, j, n;
+    if (!(g->flags & GRAPH_ARENA))
+        free(p);
+}
 
-    if ((maxLevel != -1) && (level >= maxLevel)) return pending_break;
+/* links g->nodes[i] in the chain of its name, in order */
 
-    if (!g) return 0;
+static void indexLink(Graph g, int i)
+{
+    struct _GraphIndex *x = g->index;
+    struct _GraphIndexSlot *e;
+    Graph node = g->nodes[i];
+    unsigned long h;
+    int j, k;
+
+    h = OgdlSymtab_hash(node->name,strlen(node->name));
+    for (k = h & (x->size-1); ; k = (k+1) & (x->size-1)) {
+        e = x->slots + k;
+        if (e->first == SLOT_FREE) {
+            e->hash = h;
+            e->first = e->last = i;
+            x->next[i] = -1;
+            x->count++;
+            break;
+        }
+        if (e->first < 0 || e->hash != h || !sameNames(g->nodes[e->first],node))
+            continue;
+        if (i > e->last) {
+            x->next[e->last] = i;
+            x->next[i] = -1;
+            e->last = i;
+        }
+        else if (i < e->first) {
+            x->next[i] = e->first;
+            e->first = i;
+        }
+        else {
+            for (j = e->first; x->next[j] < i; j = x->next[j])
+                ;
+            x->next[i] = x->next[j];
+            x->next[j] = i;
+        }
+        break;
+    }
 
-    n = level * nspaces;
+    /* shared nodes are indexed already: do not write to them */
+    if (!(node->flags & GRAPH_INDEXED))
+        node->flags |= GRAPH_INDEXED;
+}
 
-    j = Graph_fprintString(fp,g->name,n,pending_break);
+/* unlinks node, a subnode of g, from the chain of its name; returns its
+   position, or -1 if it is not in the index */
 
-    for (i=0; i<g->size; i++)  
-        j = _fprintGraph(fp,g->nodes[i],level+1,maxLevel,nspaces,j);
-   
-    return j;
+static int indexUnlink(Graph g, Graph node)
+{
+    struct _GraphIndex *x = g->index;
+    struct _GraphIndexSlot *e;
+    unsigned long h;
+    int i, j, k;
+
+    h = OgdlSymtab_hash(node->name,strlen(node->name));
+    for (k = h & (x->size-1); x->slots[k].first != SLOT_FREE; k = (k+1) & (x->size-1)) {
+        e = x->slots + k;
+        if (e->first < 0 || e->hash != h || !sameNames(g->nodes[e->first],node))
+            continue;
+        for (j = -1, i = e->first; i >= 0 && g->nodes[i] != node; j = i, i = x->next[i])
+            ;
+        if (i < 0)
+            return -1;
+        if (j < 0)
+            e->first = x->next[i] < 0 ? SLOT_GONE : x->next[i];
+        else
+            x->next[j] = x->next[i];
+        if (e->last == i)
+            e->last = j;
+        return i;
+    }
+    return -1;
 }
 
-/** Prints a Graph in OGDL format. 
- */
+/* links g->nodes[i] again after indexUnlink() gave i, or rebuilds */
 
-void Graph_print (Graph g)
+static void indexRelink(Graph g, int i)
 {
-    int i,j=0;
-    
-    if (!g) return;
-    
-    for (i=0; i<g->size; i++)
-        j = _fprintGraph(stdout,g->nodes[i],0,-1,4,j);
-    
-    if (j)
-        fputc('\n',stdout);
+    if (i >= 0 && g->index->count*4 < g->index->size*3)
+        indexLink(g,i);
+    else
+        indexBuild(g);
 }
 
-void Graph_fprint (Graph g, FILE *fp, int max, int nspaces, int mode)
+/* adds g->nodes[i] to the index of g */
+
+static int indexAdd(Graph g, int i)
 {
-    int i, j=0;
-    
-    if (!g) return;
+    struct _GraphIndex *x = g->index;
+    int *next, k;
+
+    if (i >= x->next_max) {
+        k = x->next_max * 2;
+        while (k <= i)
+            k *= 2;
+        next = indexAlloc(g,k * sizeof(int));
+        if (!next) return ERROR_malloc;
+        memcpy(next,x->next,x->n * sizeof(int));
+        indexFree(g,x->next);
+        x->next = next;
+        x->next_max = k;
+    }
 
-    if (mode)
-        for (i=0; i<g->size; i++)
-            j = _fprintGraph(fp,g->nodes[i],0,max,nspaces,j);
-    else 
-        j = _fprintGraph(fp,g,0,max,nspaces,j);
-    
-    if (j)
-        fputc('\n',fp);
+    /* renames in the arena of its subnodes make it stale */
+    if (!x->arena && (g->nodes[i]->flags & GRAPH_ARENA)) {
+        x->arena = g->nodes[i]->store;
+        x->epoch = RENAMES(x->arena);
+    }
+
+    indexLink(g,i);
+    x->n = i+1;
+    return 0;
 }
 
-/** add a node to a graph */
+/* (re)builds the index of g, with room for twice as many names; it is
+   rebuilt when 3/4 of the slots are used. The subnodes of a vector
+   (GRAPH_BORROWED) belong to others, that may be reading them: it has
+   none, and lookups in it scan */
 
-int Graph_addNode(Graph g, Graph node)
+static int indexBuild(Graph g)
 {
-    if (!g)
-        return ERROR_noObject;
+    struct _GraphIndex *x = g->index;
+    int i, size = 64;
+
+    if (g->flags & GRAPH_BORROWED)
+        return 0;
+
+    while (size < g->size * 2)
+        size *= 2;
+
+    if (!x) {
+        x = indexAlloc(g,sizeof(*x));
+        if (!x) return ERROR_malloc;
+        x->slots = 0;
+        x->next = 0;
+        x->size = 0;
+        x->next_max = 0;
+        g->index = x;
+    }
+
+    if (x->size < size) {
+        indexFree(g,x->slots);
+        x->slots = indexAlloc(g,size * sizeof(x->slots[0]));
+        x->size = size;
+    }
+    if (x->next_max < g->size_max) {
+        indexFree(g,x->next);
+        x->next = indexAlloc(g,g->size_max * sizeof(int));
+        x->next_max = g->size_max;
+    }
+    if (!x->slots || !x->next) {
+        indexFree(g,x->slots);
+        indexFree(g,x->next);
+        indexFree(g,x);
+        g->index = 0;
+        return ERROR_malloc;
+    }
+
+    for (i=0; i<x->size; i++)
+        x->slots[i].first = SLOT_FREE;
+    x->count = 0;
+    x->n = 0;
+    x->arena = 0;
+    x->epoch = 0;
+
+    for (i=0; i<g->size; i++)
+        indexAdd(g,i);
+    return 0;
+}
+
+/* whether subnodes in an arena were renamed since x was built */
+
+static int renamed(struct _GraphIndex *x)
+{
+    return x->arena && x->epoch != RENAMES(x->arena);
+}
+
+/* whether subnodes were added to g or renamed since x was built */
+
+static int stale(Graph g, struct _GraphIndex *x)
+{
+    return x->n != g->size || renamed(x);
+}
+
+/* the index of g if it is up to date. Lookups do not rebuild it, as
+   other threads may be reading g: they scan the subnodes instead. */
+
+static struct _GraphIndex * indexOf(Graph g)
+{
+    struct _GraphIndex *x = g->index;
+
+    return x && !stale(g,x) ? x : 0;
+}
+
+/* indexOf() for a change to g, which can rebuild it */
+
+static struct _GraphIndex * indexFresh(Graph g)
+{
+    struct _GraphIndex *x = g->index;
+
+    if (!x) return 0;
+    if (stale(g,x) && indexBuild(g))
+        return 0;
+    return g->index;
+}
+
+/* the position of the n-th subnode of g with the name of step s, or -1 */
+
+static int nthPos(Graph g, OgdlPathStep *s, int interned, int n)
+{
+    struct _GraphIndex *x;
+    unsigned long h;
+    int i, k;
+
+    if (n < 0) return -1;
+
+    if ((x = indexOf(g))) {
+        h = s->hash ? s->hash : OgdlSymtab_hash(s->name,strlen(s->name));
+        for (k = h & (x->size-1); x->slots[k].first != SLOT_FREE; k = (k+1) & (x->size-1)) {
+            i = x->slots[k].first;
+            if (i >= 0 && x->slots[k].hash == h && sameName(g->nodes[i],s,interned)) {
+                while (n-- && i >= 0)
+                    i = x->next[i];
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    for (i=0; i<g->size; i++)
+        if (sameName(g->nodes[i],s,interned) && !n--)
+            return i;
+    return -1;
+}
+
+/* the n-th subnode of g with the name of step s (see getNode()) */
+
+static Graph nthNode(Graph g, OgdlPathStep *s, int interned, int n)
+{
+    int i = nthPos(g,s,interned,n);
+
+    return i < 0 ? 0 : g->nodes[i];
+}
+
+/** add a node to a graph. Nodes shared with a snapshot cannot be
+    changed (ERROR_shared): see Graph_own().
+ */
+
+int Graph_addNode(Graph g, Graph node)
+{
+    if (!g)
+        return ERROR_noObject;
     
     if (!node) 
         return ERROR_argumentIsNull;
+
+    if ((g->flags & GRAPH_COW) && unshare(g))
+        return ERROR_malloc;
+    if (REFS(g))
+        return ERROR_shared;
+
+    /* in an arena the array is copied to one twice as large */
+    if ((g->flags & GRAPH_ARENA) && (!g->nodes || g->size >= g->size_max)) {
+        Graph *p;
+        int n = g->nodes ? g->size_max * 2 : 4;
+
+        p = OgdlArena_alloc(g->store, n * sizeof(g));
+        if (!p)
+            return ERROR_malloc;
+        if (g->size)
+            memcpy(p, g->nodes, g->size * sizeof(g));
+        g->nodes = p;
+        g->size_max = n;
+    }
     
     if (!g->nodes) {
         g->nodes = (void *) malloc( CHUNK * sizeof(g) );
@@ -314,34 +1002,134 @@ int Graph_addNode(Graph g, Graph node)
         fatal("addNode: programmer error");
         
     g->nodes[g->size++] = node;
+    if (!(g->flags & GRAPH_BORROWED) && !REFS(node))
+        setParent(node,g);
+    changed(g);
+
+    /* keep the index, or make one for a node that has become wide */
+    if (g->index && !renamed(g->index) && g->index->n == g->size-1
+        && g->index->count*4 < g->index->size*3)
+        return indexAdd(g,g->size-1);
+    if (g->index || g->size >= INDEX_MIN)
+        return indexBuild(g);
 
     return 0;
 }
 
+/* a new node for a subnode of g: in the arena of g if it has one */
+
+static Graph newNode(Graph g, char *name)
+{
+    if (g && (g->flags & GRAPH_ARENA))
+        return Graph_newIn(g->store,name);
+    return Graph_new(name);
+}
+
 /** Add a node to a graph, from a string */
 
 Graph Graph_add (Graph g, char *name)
 {
-	Graph node = Graph_new(name);
+	Graph node = newNode(g,name);
 	Graph_addNode(g,node);
 	return node;
 }
 
-/** Return a subnode by index. */
+/** Add a node with a name interned in t (see Graph_newSym()) */
 
-Graph Graph_getNode (Graph g, char * name)
+Graph Graph_addSym (Graph g, OgdlSymtab t, char *name)
 {
-    int i;
     Graph node;
-    
+
+    if (!name) return 0;
+
+    node = Graph_newSym(t, (g && (g->flags & GRAPH_ARENA)) ? g->store : 0,
+                       name, strlen(name));
+    Graph_addNode(g,node);
+    return node;
+}
+
+/* Name comparison. With interned set, s->sym is the copy of the name in
+   the symbol table of the graph, or NULL if it is not there: interned
+   names are then compared by pointer, the others with strcmp(). A
+   binary node matches if all its bytes are the name. */
+
+static int sameName(Graph node, OgdlPathStep *s, int interned)
+{
+    if (interned && (node->flags & GRAPH_INTERNED))
+        return node->name == s->sym;
+    if (node->flags & GRAPH_BINARY)
+        return !memchr(node->name,0,node->len) && !strcmp(node->name,s->name);
+    return node->name == s->name || !strcmp(node->name,s->name);
+}
+
+static Graph getNode(Graph g, char *name, char *sym, int interned)
+{
+    OgdlPathStep s;
+
+    s.name = name;
+    s.sym = sym;
+    s.hash = 0;             /* nthNode() computes it if needed */
+    return nthNode(g,&s,interned,0);
+}
+
+/** Return the first subnode with the given name. Nodes with INDEX_MIN
+    or more subnodes are looked up in a hash index, which is kept by
+    Graph_addNode() and Graph_setName().
+ */
+
+Graph Graph_getNode (Graph g, char * name)
+{
     if (!name || !g) return 0;
 
-    for (i=0; i<g->size; i++) {
-        node = g->nodes[i];
-        if (!strncmp(name,node->name,MAXSTRING))
-	   return node;
+    return getNode(g,name,0,0);
+}
+
+/** Graph_getNode() for a graph whose names were interned in t: the
+    interned names are compared by pointer.
+ */
+
+Graph Graph_getNodeSym (Graph g, OgdlSymtab t, char * name)
+{
+    if (!name || !g) return 0;
+
+    return getNode(g,name,OgdlSymtab_lookup(t,name),t != 0);
+}
+
+/* OgdlPath_eval() gives a new "__vector__", or NULL */
+
+static int givesVector(OgdlPath p)
+{
+    int k;
+
+    for (k=0; k<p->nsteps; k++)
+        if (p->steps[k].type == PATH_ANY || p->steps[k].type == PATH_DESC)
+            return 1;
+    return p->nsteps && p->steps[p->nsteps-1].type == PATH_ALL;
+}
+
+/* Graph_get(); with first, the first node of the "__vector__" it would
+   give instead, which is then freed */
+
+static Graph get(Graph g, char *path, int first)
+{
+    OgdlPath p, q;
+    Graph v;
+    double buf[PATH_BUFFER/sizeof(double)];
+
+    if (!(p = q = OgdlPath_compileIn(path,buf,sizeof(buf)))
+        && !(p = OgdlPath_compile(path)))
+        return 0;
+
+    g = OgdlPath_eval(p,g);
+    if (first && g && givesVector(p)) {
+        v = g;
+        g = v->size ? v->nodes[0] : 0;
+        Graph_free(v);
     }
-    return 0;
+
+    if (!q)
+        OgdlPath_free(p);
+    return g;
 }
 
 /** Returns a Graph pointer that matches the given path, or
@@ -349,163 +1137,1489 @@ Graph Graph_getNode (Graph g, char * name)
 
 Graph Graph_get (Graph g, char * path)
 {
-    char e[256], last[256], *p;
-    Graph up=0, node;
-    int i,j,n;
+    return get(g,path,0);
+}
 
-    p = path;
-    last[0] = 0;    /* used also to distinguish between x.[n] and x[n] */
-    
-    while ( (p=Path_element(p,e)) )
-    {
-        if (e[0] == '[') {
-
-            n = atoi(e+1);  
-
-            if (n < 0)     
-                return NULL;        /* is a syntax error, but ... */    
-            if (e[1]) {
-                if (g->size > n)
-                    g = g->nodes[n];
-                else 
-                    return NULL;
+/** Graph_get() for a graph whose names were interned in t */
+
+Graph Graph_getSym (Graph g, OgdlSymtab t, char * path)
+{
+    OgdlPath p;
+    int i;
+
+    if (!(p = OgdlPath_compile(path)))
+        return 0;
+    for (i=0; i<p->nsteps; i++)
+        if (p->steps[i].name)
+            p->steps[i].sym = OgdlSymtab_lookup(t,p->steps[i].name);
+    p->symtab = t;
+    g = OgdlPath_eval(p,g);
+    OgdlPath_free(p);
+    return g;
+}
+
+/* OgdlPath_eval() of a path with * or **: a "__vector__" with all the
+   nodes that match, or NULL if there are none */
+
+static Graph matches(OgdlPath p, Graph g)
+{
+    OgdlIter it;
+    Graph v, node;
+
+    if (OgdlPath_find(p,g,&it) || !(v = Graph_new("__vector__")))
+        return 0;
+    v->flags |= GRAPH_BORROWED;
+
+    while (Graph_next(&it,&node))
+        Graph_addNode(v,node);
+
+    if (it.error || !v->size) {
+        Graph_free(v);
+        return 0;
+    }
+    return v;
+}
+
+/** Evaluates a compiled path (see OgdlPath_compile()) as Graph_get()
+    does. name[] returns a new "__vector__" node, to be freed with
+    Graph_free() (which leaves its subnodes alone); Graph_find() gives
+    the same nodes without making it. A path with * or ** returns a
+    "__vector__" with the nodes that Graph_find() gives.
+ */
+
+Graph OgdlPath_eval (OgdlPath p, Graph g)
+{
+    OgdlPathStep *s;
+    Graph v = 0, node;
+    int i, j, k, interned;
+
+    if (!p) return 0;
+
+    for (k=0; k<p->nsteps; k++)
+        if (p->steps[k].type == PATH_ANY || p->steps[k].type == PATH_DESC)
+            return g ? matches(p,g) : 0;
+
+    interned = p->symtab != 0;
+
+    for (k=0; g && k<p->nsteps; k++) {
+        s = p->steps + k;
+        switch (s->type) {
+
+        case PATH_NAME:
+            g = nthNode(g,s,interned,0);
+            break;
+
+        case PATH_INDEX:
+            g = s->n < g->size ? g->nodes[s->n] : 0;
+            break;
+
+        case PATH_NTH:
+            g = nthNode(g,s,interned,s->n);
+            break;
+
+        case PATH_ALL:
+            /* new graph and get all elements with this name */
+            node = Graph_new("__vector__");
+            if (!node) {
+                Graph_free(v);
+                return 0;
+            }
+            node->flags |= GRAPH_BORROWED;
+            for (i=0; i<g->size; i++)
+                if (sameName(g->nodes[i],s,interned))
+                    for (j=0; j<g->nodes[i]->size; j++)
+                        Graph_addNode(node,g->nodes[i]->nodes[j]);
+            Graph_free(v);
+            g = v = node;
+            break;
+        }
+    }
+
+    /* a vector that the path went on from is not returned */
+    if (v && g != v)
+        Graph_free(v);
+    return g;
+}
+
+
+/** Starts an iteration over the nodes that match path from g (see
+    Graph_next()). Returns 0, or ERROR_argumentOutOfRange if the path is
+    not valid, does not fit in ITER_BUFFER or has more than ITER_DEPTH
+    name[], * and ** steps.
+ */
+
+int Graph_find (Graph g, char *path, OgdlIter *it)
+{
+    OgdlPath p;
+
+    it->path = 0;
+    it->names = 0;
+    it->g = 0;
+    it->depth = 0;
+    it->error = 0;
+
+    p = OgdlPath_compileIn(path,it->buf,sizeof(it->buf));
+    if (!p) return ERROR_argumentOutOfRange;
+
+    return OgdlPath_find(p,g,it);
+}
+
+/** Graph_find() for a compiled path, which must outlive the iteration */
+
+int OgdlPath_find (OgdlPath p, Graph g, OgdlIter *it)
+{
+    int k, n = 0;
+
+    it->path = 0;
+    it->names = 0;
+    it->g = 0;
+    it->depth = 0;
+    it->error = 0;
+
+    if (!p) return ERROR_argumentIsNull;
+
+    for (k=0; k<p->nsteps; k++)
+        if (p->steps[k].type >= PATH_ALL)
+            n++;
+    if (n > ITER_DEPTH) return ERROR_argumentOutOfRange;
+
+    it->path = p;
+    it->names = (g && (g->flags & GRAPH_NAMES)) ? g->store : 0;
+    it->g = g;
+    it->k = 0;
+    return 0;
+}
+
+/** Graph_find() that looks up **.name in x (see Graph_indexNames())
+    for the nodes of g that are in it.
+ */
+
+int OgdlNames_find (OgdlNames x, Graph g, char *path, OgdlIter *it)
+{
+    int i;
+
+    if ((i = Graph_find(g,path,it)))
+        return i;
+    it->names = x;
+    return 0;
+}
+
+/** Attaches x, the index of g and the nodes below it (see
+    Graph_indexNames()), to g, which then frees it: Graph_get(),
+    Graph_find() and OgdlPath_eval() from g look up **.name in it
+    instead of descending. A change to g or below it drops it, as
+    Graph_setNames(g,NULL) does, but one below a node of an arena or a
+    mapped file does not (their parents are not known): drop it before.
+    A snapshot of g takes it (see Graph_snapshot()).
+
+    Returns 0, ERROR_argumentIsNull, or ERROR_argumentOutOfRange if x is
+    not of g, or if g is in an arena or reads through a snapshot (attach
+    it to the snapshot instead); x is then left to the caller.
+ */
+
+int Graph_setNames (Graph g, OgdlNames x)
+{
+    if (!g) return ERROR_argumentIsNull;
+
+    if (g->flags & GRAPH_NAMES)
+        dropNames(g);
+    if (!x) return 0;
+
+    if ((g->flags & (GRAPH_ARENA | GRAPH_COW)) || !x->count || x->nodes[0] != g)
+        return ERROR_argumentOutOfRange;
+
+    /* a change below g reaches it through the hashes (see changed()) */
+    Graph_hash(g);
+
+    x->store = g->store;
+    g->store = x;
+    g->flags |= GRAPH_NAMES;
+    return 0;
+}
+
+/** Gives the next node that matches the path of Graph_find() in *node.
+    Returns 0 when there are no more. The graph must not change during
+    the iteration; it can be left at any point.
+
+    If ** descends more than ITER_DEPTH levels, the nodes further down
+    are not given and it->error is ERROR_argumentOutOfRange.
+ */
+
+int Graph_next (OgdlIter *it, Graph *node)
+{
+    struct _OgdlIterFrame *f;
+    OgdlPathStep *s;
+    OgdlPath p = it->path;
+    Graph g, n;
+    int *pos, k, m, interned;
+
+    if (!p) return 0;
+    interned = p->symtab != 0;
+
+    for (;;) {
+        /* go on from it->g up to the end of the path or a loop */
+        if ((g = it->g)) {
+            it->g = 0;
+            for (k = it->k; g && k < p->nsteps; k++) {
+                s = p->steps + k;
+                if (s->type >= PATH_ALL)
+                    break;
+                else if (s->type == PATH_INDEX)
+                    g = s->n < g->size ? g->nodes[s->n] : 0;
+                else
+                    g = nthNode(g,s,interned,s->type == PATH_NTH ? s->n : 0);
+            }
+            if (!g)
+                continue;
+            if (k == p->nsteps) {
+                *node = g;
+                return 1;
+            }
+            if (it->depth == ITER_DEPTH) {
+                it->error = ERROR_argumentOutOfRange;
+                continue;
+            }
+            f = it->frames + it->depth++;
+            f->type = s->type;
+            f->up = g;
+            f->i = 0;
+            f->cur = 0;
+            f->j = 0;
+            f->step = k;
+
+            /* **.name are the nodes with name below g, in preorder: the
+               positions of name in OgdlNames, or a descent. Otherwise **
+               is g itself and then every node below it. */
+            if (s->type == PATH_DESC) {
+                if (k+1 < p->nsteps && s[1].type == PATH_NAME) {
+                    if (it->names
+                        && (pos = OgdlNames_below(it->names,g,s[1].name,s[1].len,&m))) {
+                        f->up = 0;
+                        f->i = pos - it->names->pos;
+                        f->j = f->i + m;
+                    }
+                }
+                else {
+                    it->g = g;
+                    it->k = k + 1;
+                }
+            }
+            continue;
+        }
+
+        if (!it->depth)
+            return 0;
+
+        f = it->frames + it->depth - 1;
+
+        switch (f->type) {
+
+        case PATH_ANY:
+            if (f->i < f->up->size) {
+                it->g = f->up->nodes[f->i++];
+                it->k = f->step + 1;
+            }
+            else
+                it->depth--;
+            break;
+
+        case PATH_DESC:
+            if (!f->up) {
+                if (f->i < f->j) {
+                    it->g = it->names->nodes[it->names->pos[f->i++]];
+                    it->k = f->step + 2;
+                }
+                else
+                    it->depth--;
             }
-            else {
-                if (up == NULL) return NULL;
-                
-                if (e[1] == 0) {        /* this means [] */
-                    /* new graph and get all elements with this name */
-                    g = Graph_new("__vector__");
-
-                    for (i=0; i<up->size; i++) {
-                        node = up->nodes[i];
-                        if (!strncmp(node->name,last,256))
-                            for (j=0; j<node->size; j++)
-                                Graph_addNode(g,node->nodes[j]);
+            else if (f->i < f->up->size) {
+                /* one level down: a frame for the subnode, which is
+                   matched against the rest of the path (**.name: if it
+                   has that name) */
+                n = f->up->nodes[f->i++];
+                k = f->step;
+                if (it->depth == ITER_DEPTH) {
+                    it->error = ERROR_argumentOutOfRange;
+                    break;
+                }
+                f = it->frames + it->depth++;
+                f->type = PATH_DESC;
+                f->up = n;
+                f->i = 0;
+                f->cur = 0;
+                f->j = 0;
+                f->step = k;
+                s = p->steps + k;
+                if (k+1 < p->nsteps && s[1].type == PATH_NAME) {
+                    if (sameName(n,s+1,interned)) {
+                        it->g = n;
+                        it->k = k + 2;
                     }
                 }
-                else if (n>=0) {
+                else {
+                    it->g = n;
+                    it->k = k + 1;
+                }
+            }
+            else
+                it->depth--;
+            break;
+
+        default:
+            /* name[]: the next subnode of the current node with name */
+            if (f->cur && f->j < f->cur->size) {
+                it->g = f->cur->nodes[f->j++];
+                it->k = f->step + 1;
+                break;
+            }
 
-                    for (i=0; i<up->size; i++) {
-                        node = up->nodes[i];
-                  
-			if (!strncmp(node->name,last,256)) {
-	
-                            if (!n--) {
-                                g = node;
-				
-                                break;
-                            }
-                        }
-                    }  
-		    if (n>-1) return NULL;              
+            /* or the next node with that name */
+            f->cur = 0;
+            s = p->steps + f->step;
+            while (f->i < f->up->size) {
+                n = f->up->nodes[f->i++];
+                if (sameName(n,s,interned)) {
+                    f->cur = n;
+                    f->j = 0;
+                    break;
                 }
-                last[0] = 0;
             }
+            if (!f->cur)
+                it->depth--;
         }
-        else if (e[0] == '.')
-            last[0] =  0;
-        else {
-            up = g;
-            if (! (g=Graph_getNode(g,e)))
-                return 0;
-            strncpy(last,e,255);
+    }
+}
+
+/* Graph_getMany(): resolves the subtree of trie node t from g */
+
+static int resolve(OgdlPathSet set, Graph g, int t, Graph *results)
+{
+    struct _OgdlPathTrie *x = set->trie + t;
+    OgdlPathStep *st[GETMANY_SCAN], *s;
+    Graph found[GETMANY_SCAN], node;
+    int count[GETMANY_SCAN], child[GETMANY_SCAN];
+    int c, i, k, m, left, n = 0;
+
+    for (i = x->path; i >= 0; i = set->next_path[i]) {
+        results[i] = g;
+        n++;
+    }
+
+    if (x->first < 0)
+        return n;
+
+    /* wide nodes have an index: look each name up in it */
+    if (x->nchildren > GETMANY_SCAN || indexOf(g)) {
+        for (c = x->first; c >= 0; c = set->trie[c].next) {
+            s = &set->trie[c].step;
+            if (s->type == PATH_INDEX)
+                node = s->n < g->size ? g->nodes[s->n] : 0;
+            else
+                node = nthNode(g,s,0,s->n);
+            if (node)
+                n += resolve(set,node,c,results);
         }
+        return n;
     }
-    return g;
+
+    /* else one scan of the subnodes for all the names */
+    left = 0;
+    for (m=0, c = x->first; c >= 0; c = set->trie[c].next, m++) {
+        s = st[m] = &set->trie[c].step;
+        child[m] = c;
+        count[m] = 0;
+        found[m] = 0;
+        if (s->type == PATH_INDEX)
+            found[m] = s->n < g->size ? g->nodes[s->n] : 0;
+        else
+            left++;
+    }
+
+    for (i=0; left && i<g->size; i++) {
+        node = g->nodes[i];
+        for (k=0; k<m; k++) {
+            s = st[k];
+            if (s->type == PATH_INDEX || found[k] || s->name[0] != node->name[0])
+                continue;
+            if (sameName(node,s,0) && count[k]++ == s->n) {
+                found[k] = node;
+                left--;
+            }
+        }
+    }
+
+    for (k=0; k<m; k++)
+        if (found[k])
+            n += resolve(set,found[k],child[k],results);
+    return n;
+}
+
+/** Resolves all the paths of a set from g in one descent: results[i]
+    is the node of path i, or NULL. The subnodes of a node are scanned
+    once for all the paths that go through it. Returns the number of
+    paths resolved.
+ */
+
+int Graph_getMany (Graph g, OgdlPathSet set, Graph *results)
+{
+    int i;
+
+    if (!set || !results) return 0;
+
+    for (i=0; i<set->npaths; i++)
+        results[i] = 0;
+
+    if (!g) return 0;
+
+    return resolve(set,g,0,results);
 }
 
+/** Returns the name of the first subnode of the node at path (its
+    value), or NULL. A path with several matches gives the first one.
+ */
+
 char * Graph_getString(Graph g, char * path)
 {
     Graph node;
     
-    node = Graph_get(g,path);
+    node = get(g,path,1);
     if (!node || !node->nodes || !node->nodes[0])
         return 0;
     return node->nodes[0]->name;
 }
 
-int Graph_set (Graph g, char * path, Graph v)
+/* gives g a copy of the index of s, if it is up to date: g has the same
+   subnodes, and copying is cheaper than building */
+
+static int indexCopy(Graph g, Graph s)
 {
-    Graph node;
-    
-    if (!g || !path || !path[0]) return 1;
-    
-    node = Graph_get(g,path);
+    struct _GraphIndex *x = s->index, *y;
 
-    if (node) {
-        if (!node->size)
-	    Graph_addNode(node,v);
-	else
-	    node->nodes[0] = v;    /* XXX memory leak ! */
-	return 0;
+    if (!x || stale(s,x))
+        return ERROR_argumentOutOfRange;
+
+    y = malloc(sizeof(*y));
+    if (!y) return ERROR_malloc;
+    *y = *x;
+    y->slots = malloc(x->size * sizeof(x->slots[0]));
+    y->next = malloc(x->next_max * sizeof(int));
+    if (!y->slots || !y->next) {
+        free(y->slots);
+        free(y->next);
+        free(y);
+        return ERROR_malloc;
     }
-    
-    node = Graph_md(g,path);        
-    Graph_addNode(node,v);
-    Graph_addNode(g,node);
+    memcpy(y->slots,x->slots,x->size * sizeof(x->slots[0]));
+    memcpy(y->next,x->next,x->n * sizeof(int));
+    g->index = y;
     return 0;
 }
 
-/** Creates a path in a graph. Like making a directory */
+/* makes the name, subnodes and index of g a copy of those of s, whose
+   subnodes are then shared */
+
+static int copyFrom(Graph g, Graph s)
+{
+    Graph *nodes = 0;
+    char *name = s->name;
+    int i;
+
+    if (s->size) {
+        nodes = malloc(s->size * sizeof(Graph));
+        if (!nodes) return ERROR_malloc;
+        memcpy(nodes,s->nodes,s->size * sizeof(Graph));
+    }
+    if (!(s->flags & GRAPH_NAME_REF)) {
+        name = (s->flags & GRAPH_BINARY) ? malloc(s->len + 1) : strdup(name);
+        if (!name) {
+            free(nodes);
+            return ERROR_malloc;
+        }
+        if (s->flags & GRAPH_BINARY)
+            memcpy(name,s->name,s->len + 1);
+    }
+
+    for (i=0; i<s->size; i++) {
+        REF_INC(nodes[i]);
+        setParent(nodes[i],0);
+    }
+
+    g->name = name;
+    g->nodes = nodes;
+    g->size = g->size_max = s->size;
+    g->index = 0;
+    g->len = s->len;
+    g->flags = (g->flags & ~(GRAPH_NAME_REF | GRAPH_INTERNED | GRAPH_BINARY | GRAPH_COW))
+             | (s->flags & (GRAPH_NAME_REF | GRAPH_INTERNED | GRAPH_BINARY));
+    if (!(s->flags & GRAPH_ARENA))
+        SET_HASH(g,HASH(s),0);
+    else
+        g->hash = 0;
+
+    if (indexCopy(g,s) && g->size >= INDEX_MIN)
+        indexBuild(g);
+    return 0;
+}
+
+/* gives g (GRAPH_COW) its own copy of the snapshot it reads through */
+
+static int unshare(Graph g)
+{
+    Graph s = g->store;
+
+    /* no snapshot is left: take its contents back */
+    if (!REFS(s)) {
+        g->name = s->name;
+        g->nodes = s->nodes;
+        g->size = s->size;
+        g->size_max = s->size_max;
+        g->index = s->index;
+        g->flags &= ~GRAPH_COW;
+        if (s->flags & GRAPH_NAMES)
+            dropNames(s);
+        g->store = s->store;
+        free(s);
+        return 0;
+    }
+
+    g->store = STORE(s);
+    if (copyFrom(g,s)) {
+        g->store = s;
+        return ERROR_malloc;
+    }
+    Graph_free(s);
+    return 0;
+}
+
+/* the subnode i of g, copied first if it is shared: g must not be */
+
+static Graph own(Graph g, int i)
+{
+    Graph node = g->nodes[i], c;
+
+    /* no longer shared, or never was: g is its only parent */
+    if (!REFS(node)) {
+        if ((node->flags & GRAPH_COW) && unshare(node))
+            return 0;
+        setParent(node,g);
+        return node;
+    }
+
+    c = malloc(sizeof(*c));
+    if (!c) return 0;
+    c->type = 0;
+    c->refs = 0;
+    c->hash = 0;
+    c->flags = node->flags & GRAPH_INDEXED;
+    c->store = g;
+    if (copyFrom(c,(node->flags & GRAPH_COW) ? node->store : node)) {
+        free(c);
+        return 0;
+    }
+
+    g->nodes[i] = c;
+    Graph_free(node);
+    return c;
+}
+
+/** Takes a snapshot of g: a graph that keeps the contents g has now,
+    whatever changes are made to g after. The snapshot shares its
+    nodes with g, and it takes constant time: the nodes of g are
+    copied as it changes, a path at a time, and only those that are
+    still shared. The snapshot must not be changed; it can be read
+    from other threads while g changes, and is freed with Graph_free().
+
+    After a snapshot has been taken, g must be changed only through
+    Graph_set(), Graph_md() and Graph_own(), or with Graph_addNode()
+    and Graph_setName() on g or on the nodes these functions return:
+    other nodes below g can be shared, and then cannot be changed
+    (ERROR_shared).
+
+    Returns NULL if out of memory, or if g is in an arena or a mapped
+    file.
+ */
+
+Graph Graph_snapshot (Graph g)
+{
+    Graph s;
+
+    if (!g || (g->flags & (GRAPH_ARENA | GRAPH_MAPPED)))
+        return 0;
+
+    /* unchanged since the last one, or a node that cannot change */
+    if (g->flags & GRAPH_COW) {
+        s = g->store;
+        REF_INC(s);
+        return s;
+    }
+    if (REFS(g)) {
+        REF_INC(g);
+        return g;
+    }
+
+    s = malloc(sizeof(*s));
+    if (!s) return 0;
+
+    s->name = g->name;
+    s->type = 0;
+    s->size = g->size;
+    s->size_max = g->size_max;
+    s->nodes = g->nodes;
+    s->index = g->index;
+    s->flags = g->flags & (GRAPH_NAME_REF | GRAPH_INTERNED | GRAPH_BORROWED | GRAPH_BINARY
+                           | GRAPH_NAMES);
+    s->len = g->len;
+    s->refs = 1;
+    s->store = g->store;        /* the parent, see setParent() */
+    s->hash = g->hash;
+    s->hash_epoch = g->hash_epoch;
+
+    /* the snapshot keeps the OgdlNames of g: it is of its nodes */
+    g->flags = (g->flags & ~GRAPH_NAMES) | GRAPH_COW;
+    g->store = s;
+    return s;
+}
+
+/** Returns the node that matches path in g, as Graph_get() does, once
+    it and the nodes above it are not shared with a snapshot, so it
+    can be changed. Paths with several matches are not allowed.
+    Returns NULL if there is no such node, or if out of memory.
+ */
+
+Graph Graph_own (Graph g, char * path)
+{
+    OgdlPath p, q = 0;
+    OgdlPathStep *s;
+    double buf[PATH_BUFFER/sizeof(double)];
+    int i, k;
+
+    if (!g || !path) return 0;
+
+    if (REFS(g) || ((g->flags & GRAPH_COW) && unshare(g)))
+        return 0;
+
+    if (!(p = OgdlPath_compileIn(path,buf,sizeof(buf)))
+        && !(p = q = OgdlPath_compile(path)))
+        return 0;
+
+    for (k=0; g && k<p->nsteps; k++) {
+        s = p->steps + k;
+        switch (s->type) {
+        case PATH_INDEX:
+            i = s->n < g->size ? s->n : -1;
+            break;
+        case PATH_NAME:
+        case PATH_NTH:
+            indexFresh(g);
+            i = nthPos(g,s,0,s->n);
+            break;
+        default:
+            i = -1;
+        }
+        g = i < 0 ? 0 : own(g,i);
+    }
+
+    OgdlPath_free(q);
+    return g;
+}
+
+/** Rebuilds the indexes of g and of the nodes below it that renames in
+    an arena left stale (see Graph_setName()); until then, lookups in
+    those nodes scan their subnodes. Nodes shared with a snapshot are
+    left as they are. Graph_publish() does it for a graph in an arena.
+    Returns 0, or ERROR_malloc.
+ */
+
+int Graph_reindex (Graph g)
+{
+    int i, e = 0;
+
+    if (!g) return ERROR_noObject;
+    if (REFS(g) || (g->flags & GRAPH_COW))
+        return 0;
+
+    if (g->index && stale(g,g->index))
+        e = indexBuild(g);
+
+    if (!(g->flags & GRAPH_BORROWED))
+        for (i=0; i<g->size && !e; i++)
+            e = Graph_reindex(g->nodes[i]);
+    return e;
+}
+
+int Graph_set (Graph g, char * path, Graph v)
+{
+    Graph node, old;
+    int i = -1;
+    
+    if (!g || !path || !path[0]) return 1;
+    
+    node = Graph_own(g,path);
+
+    if (node) {
+        if (!node->size)
+	    Graph_addNode(node,v);
+	else {
+            old = node->nodes[0];
+            if (node->index && indexFresh(node))
+                i = indexUnlink(node,old);
+	    node->nodes[0] = v;
+            if (!REFS(v))
+                setParent(v,node);
+            if (node->index)
+                indexRelink(node,i);
+            changed(node);
+
+            /* a snapshot may still have it */
+            if (REFS(old))
+                Graph_free(old);
+            else
+                setParent(old,0);       /* XXX memory leak ! */
+        }
+	return 0;
+    }
+    
+    node = Graph_md(g,path);        
+    Graph_addNode(node,v);
+    return 0;
+}
+
+/** Creates a path in a graph. Like making a directory. The nodes
+    on the path are copied if they are shared with a snapshot.
+ */
 
 Graph Graph_md (Graph g, char * path)
 {
-    char e[256], last[256], *p;
-    Graph up=0, node;
-    int i,n;
+    OgdlPath p;
+    OgdlPathStep *s;
+    Graph node;
+    int i, k;
     
     if (!g || !path || !path[0]) return 0;
+
+    if (REFS(g) || ((g->flags & GRAPH_COW) && unshare(g)))
+        return 0;
+
+    if (!(p = OgdlPath_compile(path)))
+        return 0;
     
-    p = path;
-    last[0] = 0;    /* used also to distinguish between x.[n] and x[n] */
-    
-    while ( (p=Path_element(p,e)) )
-    {
-        if (e[0] == '[') {
-
-            n = atoi(e+1);  
-
-            if (!last[0]) {
-                if (n < 0 || !e[1])     /* allow [0], but not [] */
-                    return 0;           /* is a syntax error, but ... */    
-                if (g->size > n)
-                    g = g->nodes[n];
-                else 
-		    return 0;		/* not allowed: cannot create unnamed nodes */
+    for (k=0; g && k<p->nsteps; k++) {
+        s = p->steps + k;
+        switch (s->type) {
+
+        case PATH_INDEX:
+            if (g->size > s->n)
+                g = own(g,s->n);
+            else 
+                g = 0;          /* not allowed: cannot create unnamed nodes */
+            break;
+
+        case PATH_ALL:
+        case PATH_ANY:
+        case PATH_DESC:
+            g = 0;              /* not allowed */
+            break;
+
+        default:
+            /* x[n] is the first x if there is no n-th */
+            indexFresh(g);
+            i = -1;
+            if (s->type == PATH_NTH)
+                i = nthPos(g,s,0,s->n);
+            if (i < 0)
+                i = nthPos(g,s,0,0);
+            if (i < 0) {
+                node = newNode(g,s->name);
+		Graph_addNode(g,node);
             }
-            else {
-                if (!up) return 0;
-                
-                if (e[1] == 0)          /* this means [] */
-                    return 0;		/* not allowed */
-                
-                else if (n>=0) {
-                    for (i=0; i<up->size; i++) {
-                        node = up->nodes[i];
-                        if (!strncmp(node->name,last,256)) {
-                            if (!n--) {
-                                g = node;
-                                break;
-                            }
-                        }
-                    }                
-                }
-                last[0] = 0;
+            else
+                node = own(g,i);
+            g = node;
+        }
+    }
+
+    OgdlPath_free(p);
+    return g;
+}
+
+/* the splitmix64 finalizer */
+
+static unsigned long long mix(unsigned long long h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* the hash of g; it is kept if a change below g reaches it (see
+   changed()), else *keep is cleared: a node above one whose parent
+   is not known, as a mapped graph or a node of another arena, is
+   hashed each time */
+
+static unsigned long long hashOf(Graph g, int *keep)
+{
+    unsigned long long h;
+    unsigned int e;
+    const unsigned char *p, *end;
+    Graph n;
+    int i, k = 1;
+
+    e = (g->flags & GRAPH_ARENA) ? EDITS((OgdlArena) g->store) : 0;
+    if ((h = HASH(g)) && HASH_EPOCH(g) == e)
+        return h;
+
+    /* FNV-1a of the name, then the subnodes in order */
+    h = 14695981039346656037ULL;
+    if (g->flags & GRAPH_BINARY)
+        for (p = (const unsigned char *) g->name, end = p + g->len; p < end; p++) {
+            h ^= *p;
+            h *= 1099511628211ULL;
+        }
+    else
+        for (p = (const unsigned char *) g->name; *p; p++) {
+            h ^= *p;
+            h *= 1099511628211ULL;
+        }
+    h = mix(h ^ (unsigned long long) g->size);
+    for (i=0; i<g->size; i++) {
+        n = g->nodes[i];
+        if (!n) {
+            h = mix(h);
+            continue;
+        }
+        if ((n->flags & GRAPH_MAPPED) || ((n->flags & GRAPH_ARENA) &&
+            (!(g->flags & GRAPH_ARENA) || n->store != g->store)))
+            k = 0;
+        h = mix(h + hashOf(n,&k));
+    }
+
+    if (!h) h = 1;
+    if (k)
+        SET_HASH(g,h,e);
+    else
+        *keep = 0;
+    return h;
+}
+
+/** Returns a 64 bit hash of g and the nodes below it: their names and
+    their order. It is kept in the node until the subtree changes, so
+    only the hashes of changed subtrees are computed again. Snapshots
+    can be hashed from several threads.
+ */
+
+unsigned long long Graph_hash (Graph g)
+{
+    int keep = 1;
+
+    if (!g) return 0;
+    return hashOf(g,&keep);
+}
+
+/* a and b, of the same hash, have the same names in the same shape */
+
+static int sameShape(Graph a, Graph b)
+{
+    Graph x, y;
+    int i;
+
+    if (a == b)
+        return 1;
+    if (!a || !b || a->size != b->size || !sameNames(a,b))
+        return 0;
+    for (i=0; i<a->size; i++) {
+        x = a->nodes[i];
+        y = b->nodes[i];
+        if (x != y && (Graph_hash(x) != Graph_hash(y) || !sameShape(x,y)))
+            return 0;
+    }
+    return 1;
+}
+
+/** Returns 1 if a and b have the same names in the same shape, 0 if
+    not. Trees that differ are told apart by hash (see Graph_hash());
+    those of the same hash are then compared node by node, except for
+    the subtrees that a and b share.
+ */
+
+int Graph_equal (Graph a, Graph b)
+{
+    if (a == b) return 1;
+    if (!a || !b) return 0;
+    return Graph_hash(a) == Graph_hash(b) && sameShape(a,b);
+}
+
+/* A diff is a graph, one node per operation, that gives the name and
+   the subnodes of the new node in terms of the old one:
+
+     name x         the node is renamed to x
+     keep i n       the n subnodes from position i are kept as they are
+     edit i         subnode i is kept, with the changes below i
+       ...
+     add            the nodes below are added
+       ...
+
+   Subnodes that are not kept are removed. */
+
+struct _Differ {
+    Graph ops;
+    Graph add;          /* last operation, if an add */
+    int keep;           /* run of subnodes to keep, not added yet */
+    int nkeep;
+};
+
+static Graph addOp(Graph ops, char *op, int i, int n)
+{
+    Graph g;
+    char buf[16];
+
+    if (!(g = Graph_add(ops,op)))
+        return 0;
+    if (i >= 0) {
+        sprintf(buf,"%d",i);
+        if (!Graph_add(g,buf)) return 0;
+    }
+    if (n >= 0) {
+        sprintf(buf,"%d",n);
+        if (!Graph_add(g->nodes[0],buf)) return 0;
+    }
+    return g;
+}
+
+static int flushKeep(struct _Differ *d)
+{
+    if (d->nkeep && !addOp(d->ops,"keep",d->keep,d->nkeep))
+        return ERROR_malloc;
+    d->nkeep = 0;
+    return 0;
+}
+
+static int keep(struct _Differ *d, int i, int n)
+{
+    if (d->nkeep && d->keep + d->nkeep == i) {
+        d->nkeep += n;
+        return 0;
+    }
+    if (flushKeep(d))
+        return ERROR_malloc;
+    d->add = 0;
+    d->keep = i;
+    d->nkeep = n;
+    return 0;
+}
+
+/* a node named as g: binary names go to the heap, the others as
+   newNode(parent) makes them */
+
+static Graph copyNode(Graph g, Graph parent)
+{
+    if (g->flags & GRAPH_BINARY)
+        return Graph_newBytes(g->name,g->len);
+    return newNode(parent,g->name);
+}
+
+/* a copy of g and the nodes below it, made with copyNode(parent) */
+
+static Graph copyTree(Graph g, Graph parent)
+{
+    Graph c;
+    int i;
+
+    if (!(c = copyNode(g,parent)))
+        return 0;
+    for (i=0; i<g->size; i++)
+        if (Graph_addNode(c,copyTree(g->nodes[i],c))) {
+            Graph_free(c);
+            return 0;
+        }
+    return c;
+}
+
+static int diffNode(Graph ops, Graph a, Graph b);
+
+static int diffNodes(struct _Differ *d, Graph a, Graph b)
+{
+    Graph op;
+    int n = a->size, m = b->size, p, s, i, j;
+
+    /* the same at both ends */
+    for (p=0; p<n && p<m && Graph_equal(a->nodes[p],b->nodes[p]); p++)
+        ;
+    for (s=0; s<n-p && s<m-p && Graph_equal(a->nodes[n-1-s],b->nodes[m-1-s]); s++)
+        ;
+    if (p && keep(d,0,p))
+        return ERROR_malloc;
+
+    /* in between, nodes with the same name are edited, the others
+       removed or added: whatever keeps the counts closer */
+    for (i=p, j=p; j<m-s; ) {
+        if (i < n-s && Graph_equal(a->nodes[i],b->nodes[j])) {
+            if (keep(d,i,1)) return ERROR_malloc;
+            i++, j++;
+        }
+        else if (i < n-s && sameNames(a->nodes[i],b->nodes[j])) {
+            if (flushKeep(d) || !(op = addOp(d->ops,"edit",i,-1))
+                || diffNode(op->nodes[0],a->nodes[i],b->nodes[j]))
+                return ERROR_malloc;
+            d->add = 0;
+            i++, j++;
+        }
+        else if (n-s-i > m-s-j)
+            i++;
+        else {
+            if (flushKeep(d))
+                return ERROR_malloc;
+            if (!d->add && !(d->add = Graph_add(d->ops,"add")))
+                return ERROR_malloc;
+            if (Graph_addNode(d->add,copyTree(b->nodes[j],d->add)))
+                return ERROR_malloc;
+            j++;
+        }
+    }
+
+    if (s && keep(d,n-s,s))
+        return ERROR_malloc;
+    return flushKeep(d);
+}
+
+/* the operations that make a into b, added to ops */
+
+static int diffNode(Graph ops, Graph a, Graph b)
+{
+    struct _Differ d;
+    Graph op;
+
+    d.ops = ops;
+    d.add = 0;
+    d.nkeep = 0;
+
+    if (!sameNames(a,b)) {
+        if (!(op = Graph_add(ops,"name")) || Graph_addNode(op,copyNode(b,0)))
+            return ERROR_malloc;
+    }
+    return diffNodes(&d,a,b);
+}
+
+/** Returns the changes that make a into b, as a graph that can be
+    printed, or given to Graph_patch(). Subtrees that a and b have in
+    common are skipped (see Graph_equal()), so the time it takes
+    depends on what has changed. NULL if out of memory.
+ */
+
+Graph Graph_diff (Graph a, Graph b)
+{
+    Graph d;
+
+    if (!a || !b) return 0;
+
+    if (!(d = Graph_new("diff")))
+        return 0;
+    if (Graph_equal(a,b) ? (a->size && !addOp(d,"keep",0,a->size))
+                         : diffNode(d,a,b)) {
+        Graph_free(d);
+        return 0;
+    }
+    return d;
+}
+
+/* the number that is the name of the i-th subnode of g, or -1 */
+
+static int number(Graph g, int i)
+{
+    char *end;
+    long n;
+
+    if (i >= g->size)
+        return -1;
+    n = strtol(g->nodes[i]->name,&end,10);
+    if (*end || n < 0 || n > INT_MAX)
+        return -1;
+    return n;
+}
+
+static int check(Graph g, Graph ops);
+
+/* checks that the operations of ops fit g, below too if deep is set;
+   marks the subnodes of g they keep in used, and counts the subnodes
+   they make in *n; *moved is 0 if all are kept where they are */
+
+static int checkOps(Graph g, Graph ops, char *used, int *n, int *moved, int deep)
+{
+    Graph op;
+    int i, k, at, count;
+
+    *n = 0;
+    *moved = 0;
+    for (k=0; k<ops->size; k++) {
+        op = ops->nodes[k];
+        if (!strcmp(op->name,"add")) {
+            *n += op->size;
+            *moved = 1;
+            continue;
+        }
+        if (!strcmp(op->name,"name")) {
+            if (op->size != 1)
+                return ERROR_argumentOutOfRange;
+            continue;
+        }
+
+        if ((at = number(op,0)) < 0)
+            return ERROR_argumentOutOfRange;
+        if (!strcmp(op->name,"keep")) {
+            if ((count = number(op->nodes[0],0)) < 0)
+                return ERROR_argumentOutOfRange;
+        }
+        else if (!strcmp(op->name,"edit"))
+            count = 1;
+        else
+            return ERROR_argumentOutOfRange;
+
+        if (at > g->size - count)
+            return ERROR_argumentOutOfRange;
+        for (i=at; i<at+count; i++) {
+            if (used[i])
+                return ERROR_argumentOutOfRange;
+            used[i] = 1;
+        }
+        if (deep && count == 1 && !strcmp(op->name,"edit")
+            && (i = check(g->nodes[at],op->nodes[0])))
+            return i;
+        if (at != *n)
+            *moved = 1;
+        *n += count;
+    }
+    if (*n != g->size)
+        *moved = 1;
+    return 0;
+}
+
+static int check(Graph g, Graph ops)
+{
+    char *used;
+    int n, moved, i;
+
+    if (!(used = calloc(g->size + 1,1)))
+        return ERROR_malloc;
+    i = checkOps(g,ops,used,&n,&moved,1);
+    free(used);
+    return i;
+}
+
+/* applies the operations of ops, which fit, to g, which is not shared */
+
+static int patchNode(Graph g, Graph ops)
+{
+    Graph op, node, *nodes = 0;
+    char *used;
+    int i, k, n, at, count = 0, max, moved;
+
+    used = calloc(g->size + 1,1);
+    if (!used) return ERROR_malloc;
+    checkOps(g,ops,used,&max,&moved,0);
+
+    /* the subnodes stay where they are: only the edited ones change */
+    if (!moved) {
+        free(used);
+        for (k=0; k<ops->size; k++) {
+            op = ops->nodes[k];
+            if (!strcmp(op->name,"name")) {
+                if (setName(g,op->nodes[0]->name,Graph_len(op->nodes[0]),op->nodes[0]->flags & GRAPH_BINARY))
+                    return ERROR_malloc;
             }
+            else if (!strcmp(op->name,"edit")) {
+                at = number(op,0);
+                if (!(node = own(g,at)) || (i = patchNode(node,op->nodes[0])))
+                    return ERROR_malloc;
+            }
+        }
+        changed(g);
+        return 0;
+    }
+
+    if (max) {
+        nodes = (g->flags & GRAPH_ARENA) ? OgdlArena_alloc(g->store,max * sizeof(Graph))
+                                         : malloc(max * sizeof(Graph));
+        if (!nodes) {
+            free(used);
+            return ERROR_malloc;
+        }
+    }
+
+    for (k=0; k<ops->size; k++) {
+        op = ops->nodes[k];
+        if (!strcmp(op->name,"name")) {
+            if (setName(g,op->nodes[0]->name,Graph_len(op->nodes[0]),op->nodes[0]->flags & GRAPH_BINARY))
+                goto error;
+        }
+        else if (!strcmp(op->name,"add")) {
+            for (i=0; i<op->size; i++) {
+                if (!(node = copyTree(op->nodes[i],g)))
+                    goto error;
+                setParent(node,g);
+                nodes[count++] = node;
+            }
+        }
+        else if (!strcmp(op->name,"keep")) {
+            at = number(op,0);
+            n = number(op->nodes[0],0);
+            for (i=at; i<at+n; i++)
+                nodes[count++] = g->nodes[i];
         }
-        else if (e[0] == '.')
-            last[0] =  0;
         else {
-            up = g;
-            if (! (g=Graph_getNode(g,e))) {
-                node = Graph_new(e);
-		Graph_addNode(g,node);
-		g = node;
-	    }
-            strncpy(last,e,255);
+            at = number(op,0);
+            if (!(node = own(g,at)) || patchNode(node,op->nodes[0]))
+                goto error;
+            nodes[count++] = node;
         }
     }
-    return g;
 
+    for (i=0; i<g->size; i++)
+        if (!used[i])
+            Graph_free(g->nodes[i]);
+    free(used);
+    if (!(g->flags & GRAPH_ARENA))
+        free(g->nodes);
+
+    g->nodes = nodes;
+    g->size = g->size_max = count;
+    if (g->index || count >= INDEX_MIN)
+        indexBuild(g);
+    changed(g);
+    return 0;
+
+error:
+    /* the nodes added so far go; the rest is still in g */
+    for (i=0; i<count; i++) {
+        for (k=0; k<g->size && g->nodes[k] != nodes[i]; k++)
+            ;
+        if (k == g->size)
+            Graph_free(nodes[i]);
+    }
+    if (!(g->flags & GRAPH_ARENA))
+        free(nodes);
+    free(used);
+    return ERROR_malloc;
+}
+
+/** Applies a diff from Graph_diff() to g, which then has the contents
+    of the graph the diff was made to. The nodes of g that are shared
+    with a snapshot are copied first, as in Graph_own(). Returns
+    ERROR_argumentOutOfRange, and leaves g as it is, if the diff does
+    not fit g; after ERROR_malloc g can be partly changed.
+ */
+
+int Graph_patch (Graph g, Graph diff)
+{
+    int i;
+
+    if (!g)
+        return ERROR_noObject;
+    if (!diff)
+        return ERROR_argumentIsNull;
+    if (REFS(g))
+        return ERROR_shared;
+    if ((i = check(g,diff)))
+        return i;
+    if ((g->flags & GRAPH_COW) && unshare(g))
+        return ERROR_malloc;
+
+    return patchNode(g,diff);
+}
+
+/* OgdlDedup: the distinct subtrees seen so far, by Graph_hash(). Their
+   subnodes have been interned before them, so two subtrees are equal
+   if their names are and their subnodes are the same nodes. */
+
+struct _OgdlDedupSlot {
+    unsigned long long hash;
+    Graph g;
+};
+
+struct _OgdlDedup {
+    struct _OgdlDedupSlot *slots;
+    int size;           /* a power of 2 */
+    int count;
+};
+
+/** OgdlDedup constructor: an empty table of subtrees, for
+    OgdlDedup_intern(). Returns NULL if out of memory.
+ */
+
+OgdlDedup OgdlDedup_new (void)
+{
+    OgdlDedup t;
+
+    t = malloc(sizeof(*t));
+    if (!t) return 0;
+
+    t->size = 1024;
+    t->count = 0;
+    t->slots = calloc(t->size,sizeof(*t->slots));
+    if (!t->slots) {
+        free(t);
+        return 0;
+    }
+    return t;
+}
+
+static int sameTree(Graph a, Graph b)
+{
+    int i;
+
+    if (a->size != b->size)
+        return 0;
+    if (!sameNames(a,b))
+        return 0;
+    for (i=0; i<a->size; i++)
+        if (a->nodes[i] != b->nodes[i])
+            return 0;
+    return 1;
+}
+
+static int dedupGrow(OgdlDedup t)
+{
+    struct _OgdlDedupSlot *slots, *e;
+    int i, k, size = t->size * 2;
+
+    slots = calloc(size,sizeof(*slots));
+    if (!slots) return ERROR_malloc;
+
+    for (i=0; i<t->size; i++) {
+        e = t->slots + i;
+        if (!e->g) continue;
+        for (k = e->hash & (size-1); slots[k].g; k = (k+1) & (size-1))
+            ;
+        slots[k] = *e;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/** Makes subnode i of g the node in t with the same contents, if there
+    is one: the subnode is freed, and the one in t shared (and so read
+    only: see Graph_own()). If not, the subnode goes into t. Either way,
+    returns the subnode i of g now.
+
+    The subnodes of the subnode must have been interned before, so that
+    equal subtrees are made of the same nodes. The nodes in t are not
+    owned by it, and must not change or be freed while it is used.
+ */
+
+Graph OgdlDedup_intern (OgdlDedup t, Graph g, int i)
+{
+    struct _OgdlDedupSlot *e;
+    unsigned long long h;
+    Graph node;
+    int k;
+
+    if (!t || !g || i < 0 || i >= g->size)
+        return 0;
+
+    node = g->nodes[i];
+    h = Graph_hash(node);
+
+    for (k = h & (t->size-1); (e = t->slots + k)->g; k = (k+1) & (t->size-1)) {
+        if (e->hash != h || !sameTree(e->g,node))
+            continue;
+        if (e->g == node)
+            return node;
+
+        /* same name, so the index of g holds */
+        if (node->flags & GRAPH_INDEXED)
+            e->g->flags |= GRAPH_INDEXED;
+        if (!REFS(e->g))
+            setParent(e->g,0);
+        REF_INC(e->g);
+        g->nodes[i] = e->g;
+        Graph_free(node);
+        return e->g;
+    }
+
+    /* not found: left out of a full table, the node is only not shared */
+    if (t->count * 2 >= t->size) {
+        if (dedupGrow(t))
+            return node;
+        for (k = h & (t->size-1); t->slots[k].g; k = (k+1) & (t->size-1))
+            ;
+        e = t->slots + k;
+    }
+    e->hash = h;
+    e->g = node;
+    t->count++;
+    return node;
+}
+
+/** Empties t, for another graph */
+
+void OgdlDedup_clear (OgdlDedup t)
+{
+    if (!t) return;
+
+    memset(t->slots,0,t->size * sizeof(*t->slots));
+    t->count = 0;
+}
+
+/** OgdlDedup destructor. The nodes in it are not freed. */
+
+void OgdlDedup_free (OgdlDedup t)
+{
+    if (!t) return;
+
+    free(t->slots);
+    free(t);
+}
+
+/* interns the nodes below g, bottom up; shared nodes can only be
+   interned as they are */
+
+static void dedup(OgdlDedup t, Graph g)
+{
+    Graph node;
+    int i;
+
+    for (i=0; i<g->size; i++) {
+        node = g->nodes[i];
+        if (!REFS(node) && !(node->flags & (GRAPH_COW | GRAPH_BORROWED)))
+            dedup(t,node);
+        OgdlDedup_intern(t,g,i);
+    }
+}
+
+/** Makes the subtrees of g that are equal one node, shared where they
+    were (hash consing): a graph with many repeated parts takes the
+    memory of the distinct ones. Subtrees are interned bottom up, so
+    two are equal if they have the same hash (see Graph_hash()) and,
+    to confirm it, the same name and the same subnodes: it takes
+    linear time. The shared nodes are read only, as those of a
+    snapshot: Graph_own() and Graph_set() copy them before changing
+    them, or take them back once the other references are gone, so
+    that the hashes above them are kept; Graph_free() frees them with
+    the last reference.
+
+    Nodes in an arena are shared as well, but their memory is only
+    given back with the arena.
+ */
+
+int Graph_dedup (Graph g)
+{
+    OgdlDedup t;
+
+    if (!g)
+        return ERROR_noObject;
+    if (g->flags & GRAPH_BORROWED)
+        return ERROR_argumentOutOfRange;
+    if (REFS(g))
+        return ERROR_shared;
+    if ((g->flags & GRAPH_COW) && unshare(g))
+        return ERROR_malloc;
+
+    if (!(t = OgdlDedup_new()))
+        return ERROR_malloc;
+    dedup(t,g);
+    OgdlDedup_free(t);
+    return 0;
 }
@@ -0,0 +1,302 @@
+/** \file handle.c
+
+    GraphHandle: the current version of a graph, replaced as a whole
+    with Graph_publish() while other threads read it. Readers take the
+    current version with Graph_acquire() and give it back with
+    Graph_release(): a few atomic operations, no lock. A version that
+    has been replaced is freed once no reader holds it.
+
+    Each reader holds its version in a slot of the handle (a hazard
+    pointer): Graph_publish() frees the old versions that are in no
+    slot, and keeps the others for a later Graph_publish() or
+    GraphHandle_reclaim(). There are HANDLE_SLOTS slots; more readers
+    than that wait for one to be free.
+
+    Versions are read as they are: lookups do not write to them. An
+    index that renames in an arena left stale (see Graph_setName()) is
+    not rebuilt by readers, who scan the subnodes instead; Graph_publish()
+    rebuilds those of a graph in an arena before readers can get it
+    (Graph_reindex()). Graphs from Ogdl_load() or Graph_snapshot() can
+    be published as they are.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#include "ogdl.h"
+
+#define HANDLE_SLOTS 128    /* readers that can hold a version at once */
+#define SLOT_SIZE    64     /* a slot per cache line */
+
+#if defined(__GNUC__)
+#define LOAD(p)         __atomic_load_n(p,__ATOMIC_SEQ_CST)
+#define STORE(p,v)      __atomic_store_n(p,v,__ATOMIC_SEQ_CST)
+#define EXCHANGE(p,v)   __atomic_exchange_n(p,v,__ATOMIC_SEQ_CST)
+#define CAS(p,old,v)    __atomic_compare_exchange_n(p,old,v,0,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED)
+#define THREAD_LOCAL    __thread
+#else
+#define LOAD(p)         (*(p))
+#define STORE(p,v)      (*(p) = (v))
+#define EXCHANGE(p,v)   exchange((void **)(p),v)
+#define CAS(p,old,v)    (*(p) == *(old) ? (*(p) = (v), 1) : (*(old) = *(p), 0))
+#define THREAD_LOCAL
+
+static void * exchange(void **p, void *v)
+{
+    void *old = *p;
+
+    *p = v;
+    return old;
+}
+#endif
+
+struct _GraphHandleSlot {
+    Graph g;            /* version held by a reader, or NULL */
+    char pad[SLOT_SIZE - sizeof(Graph)];
+};
+
+struct _GraphHandle {
+    Graph current;
+    struct _GraphHandleSlot slots[HANDLE_SLOTS];
+    Graph *retired;     /* replaced versions not freed yet */
+    int nretired;
+    int retired_max;
+#ifndef _WIN32
+    pthread_mutex_t lock;   /* between publishers */
+#endif
+};
+
+/* the slot where a thread looks first, so that readers on different
+   threads do not contend for the same one */
+
+static THREAD_LOCAL int hint = -1;
+static int threads = 0;
+
+static int firstSlot(void)
+{
+    if (hint < 0) {
+#if defined(__GNUC__)
+        hint = __atomic_fetch_add(&threads,1,__ATOMIC_RELAXED) % HANDLE_SLOTS;
+#else
+        hint = threads++ % HANDLE_SLOTS;
+#endif
+    }
+    return hint;
+}
+
+static void lock(GraphHandle h)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&h->lock);
+#endif
+}
+
+static void unlock(GraphHandle h)
+{
+#ifndef _WIN32
+    pthread_mutex_unlock(&h->lock);
+#endif
+}
+
+/** GraphHandle constructor. g, the first version, can be NULL; the
+    handle owns it from now on.
+ */
+
+GraphHandle GraphHandle_new (Graph g)
+{
+    GraphHandle h;
+
+    h = calloc(1,sizeof(*h));
+    if (!h) return 0;
+
+#ifndef _WIN32
+    if (pthread_mutex_init(&h->lock,0)) {
+        free(h);
+        return 0;
+    }
+#endif
+    h->current = g;
+    return h;
+}
+
+/** Returns the current version of the graph of h, which stays valid
+    (and unchanged) until given back with Graph_release(), whatever
+    is published meanwhile. NULL if there is none.
+ */
+
+Graph Graph_acquire (GraphHandle h)
+{
+    Graph g, none;
+    int i, k, first;
+
+    if (!h) return 0;
+
+    first = firstSlot();
+    for (;;) {
+        if (!(g = LOAD(&h->current)))
+            return 0;
+
+        /* hold it, then check that it was not replaced before */
+        for (k=0, i=first; k<HANDLE_SLOTS; k++, i = (i+1) % HANDLE_SLOTS) {
+            none = 0;
+            if (CAS(&h->slots[i].g,&none,g))
+                break;
+        }
+        if (k == HANDLE_SLOTS) {
+#ifndef _WIN32
+            sched_yield();
+#endif
+            continue;
+        }
+
+        if (LOAD(&h->current) == g)
+            return g;
+        STORE(&h->slots[i].g,(Graph) 0);
+    }
+}
+
+/** Gives back a version taken with Graph_acquire() */
+
+void Graph_release (GraphHandle h, Graph g)
+{
+    Graph mine;
+    int i, k;
+
+    if (!h || !g) return;
+
+    /* slots that hold the same version are alike: any of them will do */
+    for (k=0, i=firstSlot(); k<HANDLE_SLOTS; k++, i = (i+1) % HANDLE_SLOTS) {
+        mine = g;
+        if (CAS(&h->slots[i].g,&mine,(Graph) 0))
+            return;
+    }
+}
+
+static int held(GraphHandle h, Graph g)
+{
+    int i;
+
+    for (i=0; i<HANDLE_SLOTS; i++)
+        if (LOAD(&h->slots[i].g) == g)
+            return 1;
+    return 0;
+}
+
+/* whether g is, or was, a version of h that readers may hold; h is
+   locked */
+
+static int published(GraphHandle h, Graph g)
+{
+    int i;
+
+    if (LOAD(&h->current) == g)
+        return 1;
+    for (i=0; i<h->nretired; i++)
+        if (h->retired[i] == g)
+            return 1;
+    return 0;
+}
+
+/* frees the retired versions that no reader holds; h is locked */
+
+static int reclaim(GraphHandle h)
+{
+    int i, n = 0;
+
+    for (i=0; i<h->nretired; i++) {
+        if (held(h,h->retired[i]))
+            h->retired[n++] = h->retired[i];
+        else
+            Graph_free(h->retired[i]);
+    }
+    h->nretired = n;
+    return n;
+}
+
+/** Makes g the current version of the graph of h: readers get it from
+    the next Graph_acquire() on. The handle owns g from now on, and
+    frees the version it replaces when no reader holds it any more.
+    g can be a snapshot (see Graph_snapshot()) of a graph that goes on
+    changing.
+ */
+
+int Graph_publish (GraphHandle h, Graph g)
+{
+    Graph old, *p;
+    int n;
+
+    if (!h)
+        return ERROR_noObject;
+
+    lock(h);
+
+    /* make room first: once out, the old version must be kept */
+    if (h->nretired >= h->retired_max) {
+        n = h->retired_max ? h->retired_max * 2 : 16;
+        p = realloc(h->retired,n * sizeof(Graph));
+        if (!p) {
+            unlock(h);
+            return ERROR_malloc;
+        }
+        h->retired = p;
+        h->retired_max = n;
+    }
+
+    /* not seen by readers yet, unless published before */
+    if (g && (g->flags & GRAPH_ARENA) && !published(h,g))
+        Graph_reindex(g);
+
+    old = EXCHANGE(&h->current,g);
+
+    /* the same snapshot again: only the reference it came with goes */
+    if (old == g) {
+        if (g && LOAD(&g->refs))
+            Graph_free(g);
+    }
+    else if (old)
+        h->retired[h->nretired++] = old;
+
+    reclaim(h);
+    unlock(h);
+    return 0;
+}
+
+/** Frees the replaced versions that no reader holds any more, as
+    Graph_publish() does. Returns the number of those left.
+ */
+
+int GraphHandle_reclaim (GraphHandle h)
+{
+    int n;
+
+    if (!h) return 0;
+
+    lock(h);
+    n = reclaim(h);
+    unlock(h);
+    return n;
+}
+
+/** GraphHandle destructor: frees all the versions. No reader must
+    hold any of them.
+ */
+
+void GraphHandle_free (GraphHandle h)
+{
+    int i;
+
+    if (!h) return;
+
+    for (i=0; i<h->nretired; i++)
+        Graph_free(h->retired[i]);
+    Graph_free(h->current);
+    free(h->retired);
+#ifndef _WIN32
+    pthread_mutex_destroy(&h->lock);
+#endif
+    free(h);
+}
@@ -0,0 +1,200 @@
+/** \file names.c
+
+    OgdlNames: the nodes of a graph by name. The nodes are numbered in
+    preorder, so the nodes below one are those that follow it up to the
+    end of its subtree, and the nodes named x below it are a range of
+    the positions of x, found by binary search. This is what makes
+    **.x a lookup instead of a descent.
+
+    The index is of the graph as it was when built, and must be built
+    again after the graph changes. Lookups do not modify it, so it can
+    be read from several threads. Attached to the graph with
+    Graph_setNames(), it is used by Graph_get() and Graph_find() too, and
+    dropped when the graph changes.
+*/
+
+#include "ogdl.h"
+
+static int count(Graph g)
+{
+    int i, n = 1;
+
+    for (i=0; i<g->size; i++)
+        n += count(g->nodes[i]);
+    return n;
+}
+
+/* numbers g and the nodes below it from i; returns the next number */
+
+static int number(OgdlNames x, Graph g, int i)
+{
+    int k, me = i++;
+
+    x->nodes[me] = g;
+    for (k=0; k<g->size; k++)
+        i = number(x,g->nodes[k],i);
+    x->end[me] = i;
+    return i;
+}
+
+static unsigned long pointerHash(Graph g)
+{
+    return ((unsigned long) g >> 4) * 0x9e3779b1UL;
+}
+
+/* the slot of a name, or the empty slot where it goes; while building,
+   first is the position of a node with the name */
+
+static struct _OgdlNamesSlot * slot(OgdlNames x, const char *name, int len, unsigned long h, int built)
+{
+    struct _OgdlNamesSlot *e;
+    Graph g;
+    int k;
+
+    for (k = h & (x->names_size-1); ; k = (k+1) & (x->names_size-1)) {
+        e = x->names + k;
+        if (e->first < 0)
+            return e;
+        if (e->hash != h)
+            continue;
+        g = x->nodes[built ? x->pos[e->first] : e->first];
+        if (Graph_len(g) == len && !memcmp(g->name,name,len))
+            return e;
+    }
+}
+
+/** Builds the index of the names of g and the nodes below it.
+    Returns NULL if out of memory.
+ */
+
+OgdlNames Graph_indexNames (Graph g)
+{
+    OgdlNames x;
+    struct _OgdlNamesSlot *e;
+    int *which = 0, i, k, n, len, size;
+    unsigned long h;
+
+    if (!g) return 0;
+
+    x = calloc(1,sizeof(*x));
+    if (!x) return 0;
+
+    x->count = n = count(g);
+    for (size = 64; size < n*2; size *= 2)
+        ;
+    x->names_size = x->where_size = size;
+
+    x->nodes = malloc(n * sizeof(Graph));
+    x->end = malloc(n * sizeof(int));
+    x->pos = malloc(n * sizeof(int));
+    x->names = malloc(size * sizeof(*x->names));
+    x->where = malloc(size * sizeof(int));
+    which = malloc(n * sizeof(int));
+    if (!x->nodes || !x->end || !x->pos || !x->names || !x->where || !which) {
+        free(which);
+        OgdlNames_free(x);
+        return 0;
+    }
+
+    number(x,g,0);
+
+    for (k=0; k<size; k++) {
+        x->names[k].first = -1;
+        x->names[k].n = 0;
+        x->where[k] = -1;
+    }
+
+    /* count the nodes of each name */
+    for (i=0; i<n; i++) {
+        len = Graph_len(x->nodes[i]);
+        h = OgdlSymtab_hash(x->nodes[i]->name,len);
+        e = slot(x,x->nodes[i]->name,len,h,0);
+        if (e->first < 0) {
+            e->hash = h;
+            e->first = i;
+        }
+        e->n++;
+        which[i] = e - x->names;
+
+        for (k = pointerHash(x->nodes[i]) & (size-1); x->where[k] >= 0; k = (k+1) & (size-1))
+            ;
+        x->where[k] = i;
+    }
+
+    /* give each name its run in pos, and fill them in preorder */
+    for (k=0, i=0; k<size; k++) {
+        e = x->names + k;
+        if (e->first < 0) continue;
+        e->first = i;
+        i += e->n;
+        e->n = 0;
+    }
+    for (i=0; i<n; i++) {
+        e = x->names + which[i];
+        x->pos[e->first + e->n++] = i;
+    }
+
+    free(which);
+    return x;
+}
+
+/* the first of the n positions at p that is not less than i */
+
+static int lowerBound(int *p, int n, int i)
+{
+    int lo = 0, hi = n, m;
+
+    while (lo < hi) {
+        m = (lo + hi) / 2;
+        if (p[m] < i)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
+}
+
+/** Returns the positions in x->nodes of the nodes named name (len
+    bytes) below g, in preorder, and their number in *n. If g is not in
+    the index, returns NULL and *n is -1.
+ */
+
+int * OgdlNames_below (OgdlNames x, Graph g, const char *name, int len, int *n)
+{
+    struct _OgdlNamesSlot *e;
+    int k, p, lo, hi;
+
+    *n = -1;
+    if (!x || !g || !name) return 0;
+
+    for (k = pointerHash(g) & (x->where_size-1); ; k = (k+1) & (x->where_size-1)) {
+        if ((p = x->where[k]) < 0)
+            return 0;
+        if (x->nodes[p] == g)
+            break;
+    }
+
+    *n = 0;
+    e = slot(x,name,len,OgdlSymtab_hash(name,len),1);
+    if (e->first < 0)
+        return x->pos;
+
+    lo = lowerBound(x->pos + e->first,e->n,p+1);
+    hi = lowerBound(x->pos + e->first,e->n,x->end[p]);
+    *n = hi - lo;
+    return x->pos + e->first + lo;
+}
+
+/** OgdlNames destructor. The graph is not freed. */
+
+void OgdlNames_free (OgdlNames x)
+{
+    if (!x) return;
+
+    free(x->nodes);
+    free(x->end);
+    free(x->pos);
+    free(x->names);
+    free(x->where);
+    free(x);
+}
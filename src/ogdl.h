@@ -33,9 +33,21 @@ typedef int (*readFunction)(int fd);
 
 typedef void (*eventHandlerFunction)(void *object, int level, int type, char *data);
 
+/** batched events: n records, the data of each is text[offset] and
+    has length bytes (it is also NUL terminated) */
+
+typedef struct _OgdlEvent {
+    int  level;
+    int  type;
+    long offset;
+    long length;
+} OgdlEvent;
+
+typedef void (*batchHandlerFunction)(void *object, const char *text, OgdlEvent *ev, int n);
+
 /** error handler (pointer to object, error number) */
 
-typedef void (*errorHandlerFunction)(void *object, int errno);
+typedef void (*errorHandlerFunction)(void *object, int error);
 
 // XXX should have negative values:
 
@@ -62,10 +74,52 @@ enum {
     ERROR_argumentOutOfRange,
     ERROR_noObject,
     ERROR_argumentIsNull,
+    ERROR_write,
+    ERROR_shared,
     ERROR_max /* Not actually a valid error number */
 };
 
 
+/** OgdlArena: bump allocation from large chunks, released at once */
+
+typedef struct _OgdlArena {
+    struct _OgdlArenaChunk *chunk;  /* current chunk */
+    char * pos;                     /* free space in it */
+    char * end;
+    size_t chunk_size;
+    unsigned long renames;          /* of indexed nodes, see Graph_setName() */
+    unsigned int edits;             /* changes, see Graph_hash() */
+} * OgdlArena;
+
+EXTERN OgdlArena OgdlArena_new    (size_t chunk_size);
+EXTERN void *    OgdlArena_alloc  (OgdlArena a, size_t size);
+EXTERN char *    OgdlArena_strdup (OgdlArena a, const char *s, size_t len);
+EXTERN void      OgdlArena_reset  (OgdlArena a);
+EXTERN void      OgdlArena_free   (OgdlArena a);
+
+/** OgdlSymtab: interned strings, one shared copy of each */
+
+struct _OgdlSym {
+    char * name;
+    unsigned long hash;
+    int    len;
+};
+
+typedef struct _OgdlSymtab {
+    struct _OgdlSym *slots; /* open addressing, size is a power of 2 */
+    size_t size;
+    size_t count;
+    OgdlArena arena;        /* the strings */
+} * OgdlSymtab;
+
+#define SYMBOL_MAX 64       /* longer names are not interned */
+
+EXTERN OgdlSymtab OgdlSymtab_new    (void);
+EXTERN char *     OgdlSymtab_intern (OgdlSymtab t, const char *s, int len);
+EXTERN char *     OgdlSymtab_lookup (OgdlSymtab t, const char *s);
+EXTERN void       OgdlSymtab_free   (OgdlSymtab t);
+EXTERN unsigned long OgdlSymtab_hash (const char *s, int len);
+
 /** Graph */
 
 typedef struct _Graph {
@@ -74,9 +128,46 @@ typedef struct _Graph {
     int    size;
     int    size_max;
     struct _Graph **nodes;
+    int    flags;       /* GRAPH_* bits */
+    int    refs;        /* references to this node besides the first one */
+    void * store;       /* storage kept alive by this node (see flags), or
+                           the node it was added to */
+    struct _GraphIndex *index;  /* subnodes by name, for nodes with many */
+    unsigned long long hash;    /* of the subtree, 0: not known (Graph_hash()) */
+    unsigned int hash_epoch;
+    int    len;         /* GRAPH_BINARY: bytes in name, which can hold 0s */
 } * Graph;
 
+#define GRAPH_NAME_REF  1   /* name is not owned (not freed) by the node */
+#define GRAPH_MAPPED    2   /* store is an OgdlMap, unmapped with the node */
+#define GRAPH_ARENA     4   /* node and nodes array are in the OgdlArena store */
+#define GRAPH_INTERNED  8   /* name is a string of an OgdlSymtab */
+#define GRAPH_INDEXED   16  /* node is in the index of another node */
+#define GRAPH_BORROWED  32  /* subnodes are not owned (not freed) by the node */
+#define GRAPH_COW       64  /* name, subnodes and index are those of the
+                               snapshot in store, until the node changes;
+                               the snapshot keeps the parent */
+#define GRAPH_BINARY    128 /* name is len bytes, not a C string (Graph_newBytes()) */
+#define GRAPH_NAMES     256 /* store is an OgdlNames of the graph, which keeps
+                               what store was (Graph_setNames()) */
+
+/** A memory mapped file */
+
+typedef struct _OgdlMap {
+    void * addr;
+    size_t len;
+} * OgdlMap;
+
 EXTERN Graph   Graph_new             (char * name);
+EXTERN Graph   Graph_newLen          (char * name, int len);
+EXTERN Graph   Graph_newRef          (char * name);
+EXTERN Graph   Graph_newBytes        (const void * bytes, int len);
+EXTERN Graph   Graph_newIn           (OgdlArena a, char * name);
+EXTERN Graph   Graph_newLenIn        (OgdlArena a, char * name, int len);
+EXTERN Graph   Graph_newSym          (OgdlSymtab t, OgdlArena a, char * name, int len);
+EXTERN Graph   Graph_addSym          (Graph g, OgdlSymtab t, char * name);
+EXTERN Graph   Graph_getNodeSym      (Graph g, OgdlSymtab t, char * name);
+EXTERN Graph   Graph_getSym          (Graph g, OgdlSymtab t, char * path);
 EXTERN void    Graph_free            (Graph g);
 EXTERN Graph   Graph_get             (Graph g, char * path);
 EXTERN char *  Graph_getString       (Graph g, char * path);
@@ -84,6 +175,9 @@ EXTERN int     Graph_set             (Graph g, char * path, Graph node);
 EXTERN Graph   Graph_md              (Graph g, char * path);
 EXTERN Graph   Graph_getNode         (Graph g, char * name);
 EXTERN int     Graph_setName         (Graph g, char *s);
+EXTERN int     Graph_setBytes        (Graph g, const void *bytes, int len);
+EXTERN char *  Graph_getBytes        (Graph g, int *len);
+EXTERN int     Graph_len             (Graph g);
 EXTERN int     Graph_addNode         (Graph g, Graph node);
 EXTERN Graph   Graph_add             (Graph g, char *name);
 EXTERN void    Graph_print           (Graph g);
@@ -94,21 +188,200 @@ EXTERN int     Graph_size            (Graph g);
 EXTERN Graph   Graph_getByIndex      (Graph g, int index);
 EXTERN char *  Graph_getNameByIndex  (Graph g, int index);
 EXTERN char *  Graph_getName         (Graph g);
-
+EXTERN int     Graph_writeFd         (Graph g, int fd, int maxlevel, int nspaces, int mode);
+EXTERN char *  Graph_toBuffer        (Graph g, int maxlevel, int nspaces, int mode, size_t *len);
+EXTERN int     Graph_writeParallel   (Graph g, int fd, int maxlevel, int nspaces, int mode, int nthreads);
+EXTERN Graph   Graph_snapshot        (Graph g);
+EXTERN Graph   Graph_own             (Graph g, char * path);
+EXTERN int     Graph_reindex         (Graph g);
+EXTERN unsigned long long Graph_hash (Graph g);
+EXTERN int     Graph_equal           (Graph a, Graph b);
+EXTERN Graph   Graph_diff            (Graph a, Graph b);
+EXTERN int     Graph_patch           (Graph g, Graph diff);
+EXTERN int     Graph_dedup           (Graph g);
+
+/** OgdlDedup: one node for each distinct subtree (hash consing) */
+
+typedef struct _OgdlDedup * OgdlDedup;
+
+EXTERN OgdlDedup OgdlDedup_new    (void);
+EXTERN Graph     OgdlDedup_intern (OgdlDedup t, Graph g, int i);
+EXTERN void      OgdlDedup_clear  (OgdlDedup t);
+EXTERN void      OgdlDedup_free   (OgdlDedup t);
+
+/** GraphHandle: the current version of a graph, read without locks
+    while new versions are published */
+
+typedef struct _GraphHandle * GraphHandle;
+
+EXTERN GraphHandle GraphHandle_new     (Graph g);
+EXTERN Graph       Graph_acquire       (GraphHandle h);
+EXTERN void        Graph_release       (GraphHandle h, Graph g);
+EXTERN int         Graph_publish       (GraphHandle h, Graph g);
+EXTERN int         GraphHandle_reclaim (GraphHandle h);
+EXTERN void        GraphHandle_free    (GraphHandle h);
+
+
+/** FrozenGraph: an immutable Graph in one array, in preorder */
+
+typedef struct _FrozenNode {
+    long name;          /* offset in pool */
+    int  len;           /* of the name */
+    int  size;          /* number of subnodes */
+    int  first;         /* first subnode, or -1 */
+    int  next;          /* next sibling, or -1 */
+    int  subtree;       /* nodes in the subtree of this one, itself included */
+    int  parent;        /* -1 for the root */
+} FrozenNode;
+
+typedef struct _FrozenGraph {
+    FrozenNode *nodes;
+    int    count;
+    char * pool;        /* the names, NUL terminated */
+    long   pool_len;
+    int *  hash;        /* subnodes of wide nodes by (parent, name) */
+    int    hash_size;
+} * FrozenGraph;
+
+EXTERN FrozenGraph Graph_freeze           (Graph g);
+EXTERN Graph       Graph_thaw             (FrozenGraph f, int node);
+EXTERN void        FrozenGraph_free       (FrozenGraph f);
+EXTERN int         FrozenGraph_get        (FrozenGraph f, int node, char * path);
+EXTERN int         FrozenGraph_getNode    (FrozenGraph f, int node, char * name);
+EXTERN int         FrozenGraph_getByIndex (FrozenGraph f, int node, int index);
+EXTERN char *      FrozenGraph_getName    (FrozenGraph f, int node);
+EXTERN int         FrozenGraph_size       (FrozenGraph f, int node);
+EXTERN void        FrozenGraph_fprint     (FrozenGraph f, int node, FILE *fp, int maxlevel, int nspaces, int mode);
 
 /** Path */
 
 EXTERN char *  Path_element       (char * path, char * buf);
 
+/** OgdlPath: a compiled path */
+
+#define PATH_NAME   0   /* the first subnode with name */
+#define PATH_INDEX  1   /* .[n] : the n-th subnode */
+#define PATH_NTH    2   /* name[n] : the n-th subnode with name */
+#define PATH_ALL    3   /* name[] : the subnodes of all subnodes with name */
+#define PATH_ANY    4   /* * : every subnode */
+#define PATH_DESC   5   /* ** : the node and every node below it */
+
+typedef struct _OgdlPathStep {
+    int    type;
+    int    n;
+    char * name;        /* NUL terminated, for PATH_NAME, _NTH and _ALL */
+    int    len;
+    unsigned long hash; /* OgdlSymtab_hash() of name, or 0: not computed */
+    char * sym;         /* interned name, see OgdlPath_intern() */
+} OgdlPathStep;
+
+typedef struct _OgdlPath {
+    OgdlPathStep *steps;
+    int    nsteps;
+    char * names;
+    OgdlSymtab symtab;  /* names are interned in it, or NULL */
+} * OgdlPath;
+
+EXTERN OgdlPath OgdlPath_compile   (const char * path);
+EXTERN OgdlPath OgdlPath_compileIn (const char * path, void * buf, size_t size);
+EXTERN int      OgdlPath_intern    (OgdlPath p, OgdlSymtab t);
+EXTERN Graph    OgdlPath_eval      (OgdlPath p, Graph g);
+EXTERN void     OgdlPath_free      (OgdlPath p);
+EXTERN int      FrozenGraph_getStep (FrozenGraph f, int node, OgdlPathStep * s);
+
+/** OgdlPathSet: paths resolved together by Graph_getMany() */
+
+struct _OgdlPathTrie {
+    OgdlPathStep step;
+    int first;          /* first child in the trie, or -1 */
+    int next;           /* next sibling, or -1 */
+    int nchildren;
+    int path;           /* first path that ends here, or -1 */
+};
+
+typedef struct _OgdlPathSet {
+    struct _OgdlPathTrie *trie; /* node 0 is the root */
+    int    ntrie;
+    int    trie_max;
+    OgdlPath *paths;    /* compiled paths, owning the step names */
+    int *  next_path;   /* next path that ends at the same trie node */
+    int    npaths;
+} * OgdlPathSet;
+
+EXTERN OgdlPathSet OgdlPathSet_new  (char ** paths, int n);
+EXTERN void        OgdlPathSet_free (OgdlPathSet set);
+EXTERN int         Graph_getMany    (Graph g, OgdlPathSet set, Graph * results);
+
+/** OgdlNames: the nodes of a graph by name, in preorder, so that the
+    nodes named x below a node (**.x) are found without a descent. */
+
+struct _OgdlNamesSlot {
+    unsigned long hash;
+    int first;          /* its run in pos, -1: empty slot */
+    int n;
+};
+
+typedef struct _OgdlNames {
+    Graph *nodes;       /* the graph in preorder */
+    int *  end;         /* nodes[i+1..end[i]) are the nodes below nodes[i] */
+    int    count;
+    int *  pos;         /* positions in nodes, grouped by name, ascending */
+    struct _OgdlNamesSlot *names;
+    int    names_size;
+    int *  where;       /* positions by node pointer */
+    int    where_size;
+    void * store;       /* that of the node it is attached to */
+} * OgdlNames;
+
+EXTERN OgdlNames Graph_indexNames (Graph g);
+EXTERN int *     OgdlNames_below  (OgdlNames x, Graph g, const char * name, int len, int * n);
+EXTERN void      OgdlNames_free   (OgdlNames x);
+EXTERN int       Graph_setNames   (Graph g, OgdlNames x);
+
+/** OgdlIter: the nodes that match a path, one at a time, without
+    allocating memory. Each name[], * and ** in the path is a loop,
+    kept in a frame; ** takes one per level it descends. */
+
+#define ITER_BUFFER 512     /* room for the compiled path in Graph_find() */
+#define ITER_DEPTH  64      /* frames */
+
+struct _OgdlIterFrame {
+    int   type;         /* PATH_ALL, _ANY or _DESC */
+    Graph up;           /* node whose subnodes are looked at */
+    int   i;            /* next of them (or of OgdlNames positions) */
+    Graph cur;          /* name[]: the node whose subnodes are given */
+    int   j;            /* next of them (or end of OgdlNames positions) */
+    int   step;
+};
+
+typedef struct _OgdlIter {
+    OgdlPath path;
+    OgdlNames names;    /* used for **.name, or NULL */
+    Graph g;            /* node to continue from at step k, or NULL */
+    int   k;
+    int   depth;
+    int   error;        /* ERROR_argumentOutOfRange: ** went deeper than ITER_DEPTH */
+    struct _OgdlIterFrame frames[ITER_DEPTH];
+    double buf[ITER_BUFFER/sizeof(double)];
+} OgdlIter;
+
+EXTERN int         Graph_find       (Graph g, char * path, OgdlIter * it);
+EXTERN int         OgdlPath_find    (OgdlPath p, Graph g, OgdlIter * it);
+EXTERN int         OgdlNames_find   (OgdlNames x, Graph g, char * path, OgdlIter * it);
+EXTERN int         Graph_next       (OgdlIter * it, Graph * node);
+
 #define LEVELS 128
 #define GROUPS 128
 #define BUFFER 65534    /* lower that int16 maxvalue, just in case */
 #define OGDL_EOS '\f'   /* XXX any char < 0x20 except NL, CR, TAB */
+#define INPUT_BUFFER 65536  /* bytes read from a file or fd at a time */
+#define EVENT_BATCH 256     /* events per call of a batchHandlerFunction */
 
 /** OgdlParser */
 
 typedef struct _OgdlParser {
     char buf[BUFFER];   /* XXX dynamic allocation */
+    int buf_len;        /* length of the token in buf */
     int level;
 
     int last_char;
@@ -127,9 +400,47 @@ typedef struct _OgdlParser {
     void *src;
     int  src_index;
     int  src_type;
+    int  src_fd;
+
+    unsigned char *in;  /* input window, in[in_pos..in_len) not yet read */
+    long in_pos;
+    long in_len;
+    long in_size;       /* allocated size of in; 0 when it points to a string */
     
     Graph *g;
     int is_comment;
+
+    int  mapped;        /* p->in is a private file mapping, see Ogdl_loadMapped */
+    long token;         /* offset in p->in where the token in p->buf starts, or -1 */
+    unsigned char *pending; /* byte to overwrite with NUL at the next event */
+
+    /* OgdlParser_feed(): state of the scanner that checks that p->in holds
+       a complete line (with its block, table or quoted continuation) */
+    int  push_state;
+    long push_pos;
+    int  push_ind;
+    int  push_n;
+    int  push_m;
+    int  push_q;
+    int  push_prev;
+    int  push_table;    /* T_* in ogdlparser.c */
+    int  push_done;
+
+    char inherited[LEVELS]; /* Ogdl_loadParallel: indentation levels used
+                               before this parse set them */
+
+    /* OgdlParser_setBatchHandler(): events not delivered yet */
+    batchHandlerFunction batch;
+    OgdlEvent *ev;
+    int  ev_n;
+    char *ev_text;
+    long ev_len;
+    long ev_size;
+
+    OgdlArena arena;    /* OgdlParser_setArena(): nodes are built in it */
+    OgdlSymtab symtab;  /* OgdlParser_setSymtab(): names are interned in it */
+    OgdlDedup dedup;    /* OgdlParser_setDedup(): subtrees are shared */
+    struct _OgdlPin **pins; /* with dedup: nodes not complete yet, by level */
 } * OgdlParser;
 
 EXTERN OgdlParser   OgdlParser_new              (void);
@@ -137,11 +448,21 @@ EXTERN OgdlParser   OgdlParser_reuse            (OgdlParser p);
 EXTERN OgdlParser   OgdlParser_detachGraph      (OgdlParser p);
 EXTERN void         OgdlParser_free             (OgdlParser p);
 EXTERN void         OgdlParser_setHandler       (OgdlParser p, eventHandlerFunction ev);
+EXTERN int          OgdlParser_setBatchHandler  (OgdlParser p, batchHandlerFunction h);
+EXTERN void         OgdlParser_flush            (OgdlParser p);
+EXTERN void         OgdlParser_setArena         (OgdlParser p, OgdlArena a);
+EXTERN void         OgdlParser_setSymtab        (OgdlParser p, OgdlSymtab t);
+EXTERN int          OgdlParser_setDedup         (OgdlParser p, int on);
 EXTERN int          OgdlParser_parse            (OgdlParser p, FILE * f);
 EXTERN int          OgdlParser_parseString      (OgdlParser p, char * s);
+EXTERN int          OgdlParser_parseFd          (OgdlParser p, int fd);
+EXTERN int          OgdlParser_feed             (OgdlParser p, char * s, long len);
+EXTERN int          OgdlParser_finish           (OgdlParser p);
 EXTERN void         OgdlParser_graphHandler     (OgdlParser p, int level, int type, char * s);
 EXTERN void         OgdlParser_printHandler     (OgdlParser p, int level, int type, char * s);
 EXTERN Graph        Ogdl_load                   (char * fileName);
+EXTERN Graph        Ogdl_loadMapped             (char * fileName);
+EXTERN Graph        Ogdl_loadParallel           (char * fileName, int nthreads);
 EXTERN void         OgdlParser_error            (OgdlParser p, int n);
 EXTERN void         OgdlParser_fatal            (OgdlParser p, int n);
 EXTERN void         OgdlParser_setErrorHandler  (OgdlParser p, errorHandlerFunction h);
@@ -153,24 +474,49 @@ EXTERN const char * OgdlParser_getErrorMessage  (int n);
 
 typedef struct _OgdlBinParser 
 {
-    char buf[BUFFER];   /* XXX dynamic allocation */
+    char *buf;          /* the current node: len bytes and a 0 */
+    long buf_size;
     int level;
 
     eventHandlerFunction handler;   
     errorHandlerFunction errorHandler; 
     
-    int  len;
+    long len;
 
     readFunction         read;
     int                  readfd; /* file descriptor to read from */    
     Graph *g;
+    int  skip;          /* level of an ignored node, whose subnodes are too; or -1 */
+
+    int  src_type;
+    unsigned char *in;  /* input window, in[in_pos..in_len) not yet read */
+    long in_pos;
+    long in_len;
+    long in_size;       /* allocated size of in; 0 when it points to a buffer */
     
 } * OgdlBinParser;
 
 EXTERN OgdlBinParser   OgdlBinParser_new          (readFunction readf, int fd);
 EXTERN void            OgdlBinParser_free         (OgdlBinParser p);
 EXTERN Graph           OgdlBinParser_parse        (OgdlBinParser p);
+EXTERN Graph           OgdlBinParser_parseBuffer  (OgdlBinParser p, const void *buf, size_t len);
 EXTERN void            OgdlBinParser_graphHandler (OgdlBinParser p, int level, int type, char *s);
+EXTERN Graph           OgdlBin_parseBuffer        (const void *buf, size_t len);
+EXTERN int             OgdlBin_write              (Graph g, int fd);
+EXTERN char *          OgdlBin_toBuffer           (Graph g, size_t *len);
+
+/** OgdlBinIndex: binary OGDL written with OgdlBin_writeIndexed(), its
+    subtrees read one at a time */
+
+#define OGDLBIN_MAGIC   "OGDLIDX1"  /* ends an indexed stream */
+#define OGDLBIN_FOOTER  32          /* index, table, entries, magic */
+
+typedef struct _OgdlBinIndex * OgdlBinIndex;
+
+EXTERN int             OgdlBin_writeIndexed       (Graph g, int fd, int depth);
+EXTERN OgdlBinIndex    OgdlBin_openIndexed        (int fd);
+EXTERN Graph           OgdlBin_getSubtree         (OgdlBinIndex x, char *path);
+EXTERN void            OgdlBin_closeIndexed       (OgdlBinIndex x);
 
 /** OgdlLog */
 
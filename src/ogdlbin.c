@@ -9,12 +9,35 @@
   binary_node ::= 0x01 (length byte[length])* 0x00
   
   where the first node is: 0x01 0x47 0x00
-  and level, length are multibyte integers.  
+  and level, length are multibyte integers: the leading 1 bits of the
+  first byte are the number of bytes that follow, most significant
+  first (0xxxxxxx, 10xxxxxx x, 110xxxxx x x, 1110xxxx x x x, 11110000
+  x x x x).
+
+  OgdlBin_write() and OgdlBin_toBuffer() (writer.c) produce it, and
+  OgdlBin_writeIndexed() with an index of subtrees that
+  OgdlBin_getSubtree() reads one at a time (see below).
+
+  Input is read in blocks of INPUT_BUFFER bytes from an fd, or taken
+  from memory, and nodes are copied out of that window in runs; the
+  readFunction of OgdlBinParser_new() is still called for each byte.
 */
 
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "ogdl.h"
 
-static int binary_node(OgdlBinParser);
+/* p->src_type */
+#define SRC_READF  0
+#define SRC_FD     1
+#define SRC_BUFFER 2
+
+#define BIN_BUFFER 4096     /* initial size of p->buf, which grows */
 
 void OgdlBinParser_graphHandler(OgdlBinParser p, int level, int type, char *s)
 {
@@ -23,12 +46,19 @@ void OgdlBinParser_graphHandler(OgdlBinParser p, int level, int type, char *s)
     
     /* format events ignored */
     if (!type) return;
-    
-    /* empty nodes are ignored */
-    if (!strlen(p->buf)) return;
 
-    /* comments are ignored */
-    if (p->buf[0] == '#') return;
+    /* so are the nodes below an ignored one */
+    if (p->skip >= 0) {
+        if (level > p->skip) return;
+        p->skip = -1;
+    }
+
+    /* comments are ignored, and empty text nodes; a binary node is
+       never one, and can be empty (Graph_newBytes()) */
+    if (type == EVENT_TEXT && (!p->len || p->buf[0] == '#')) {
+        p->skip = level;
+        return;
+    }
     
     if (!p->g) { 
         /* initialize */
@@ -50,25 +80,47 @@ void OgdlBinParser_graphHandler(OgdlBinParser p, int level, int type, char *s)
     if (level < 0)           { p->errorHandler(p,ERROR_negativeLevels); return; }
     if (p->g[level] == NULL) { p->errorHandler(p,ERROR_nullGraph); return; }
 
-    /* create a new node and add it to current level */
-    g = Graph_new(p->buf);
+    /* create a new node and add it to current level; text names end
+       at BUFFER bytes, binary ones keep them all (Graph_newBytes()) */
+    if (type == EVENT_BINARY)
+        g = Graph_newBytes(p->buf,p->len);
+    else
+        g = Graph_newLen(p->buf,p->len > BUFFER ? BUFFER : p->len);
     Graph_addNode(p->g[level],g);
     p->g[level+1]=g;
 
 }
 
+/** Constructor. The parser reads from fd, calling readf for each byte
+    if not NULL, or with read() in blocks if NULL.
+ */
+
 OgdlBinParser OgdlBinParser_new( readFunction readf, int fd )
 {
     OgdlBinParser p;
     
     p = (void *) malloc(sizeof(*p));
     if (!p) return NULL;
+
+    p->buf = malloc(BIN_BUFFER);
+    if (!p->buf) {
+        free(p);
+        return NULL;
+    }
+    p->buf[0] = 0;
+    p->buf_size = BIN_BUFFER;
+    p->len = 0;
     
     p->read = readf;
     p->g = 0;
+    p->skip = -1;
     p->handler = (void *) OgdlBinParser_graphHandler;
     p->errorHandler = (void *) OgdlParser_error;
     p->readfd=fd;
+
+    p->src_type = readf ? SRC_READF : SRC_FD;
+    p->in = 0;
+    p->in_pos = p->in_len = p->in_size = 0;
     
     return p;		
 }
@@ -82,83 +134,158 @@ void OgdlBinParser_free (OgdlBinParser p)
 	    Graph_free(p->g[0]);
 	free (p->g);
     }
+
+    if (p->in_size)
+        free(p->in);
+    free(p->buf);
     
     if (p) 
         free(p);
 }
 
-static int read(OgdlBinParser p)
+/* Refills p->in. Returns the first byte of the new window, or -1 at
+   the end of the input. A read function gives one byte at a time. */
+
+static int fill(OgdlBinParser p)
 {
-	int i= (*(p->read))(p->readfd);
-//printf("%x ",i);
-return i;	
-	
-	//return (*(p->read))(p->readfd);
+    long n;
+    int c;
+
+    if (p->src_type == SRC_READF) {
+        c = (*p->read)(p->readfd);
+        return c < 0 ? -1 : c & 0xff;
+    }
+    if (p->src_type == SRC_BUFFER)
+        return -1;
+
+    if (!p->in_size) {
+        p->in = malloc(INPUT_BUFFER);
+        if (!p->in) { p->errorHandler(p,ERROR_malloc); return -1; }
+        p->in_size = INPUT_BUFFER;
+    }
+
+    do
+        n = read(p->readfd,p->in,p->in_size);
+    while (n < 0 && errno == EINTR);
+
+    p->in_pos = 0;
+    p->in_len = n > 0 ? n : 0;
+
+    if (!p->in_len)
+        return -1;
+    return p->in[p->in_pos++];
+}
+
+#define getByte(p) ((p)->in_pos < (p)->in_len ? (p)->in[(p)->in_pos++] : fill(p))
+
+/* room for n bytes in p->buf */
+
+static int reserve(OgdlBinParser p, long n)
+{
+    char *b;
+    long size;
+
+    if (n <= p->buf_size)
+        return 1;
+
+    for (size = p->buf_size * 2; size < n; size *= 2)
+        ;
+    b = realloc(p->buf,size);
+    if (!b) {
+        p->errorHandler(p,ERROR_realloc);
+        return 0;
+    }
+    p->buf = b;
+    p->buf_size = size;
+    return 1;
 }
 
 static long integer (OgdlBinParser p)
 {
-    long c;
+    long c, n;
+    int k;
     
-    c = read(p);
+    c = getByte(p);
+
+    if (c < 0x80) return c;
+    if (c < 0xc0)      { k = 1; c &= 0x3f; }
+    else if (c < 0xe0) { k = 2; c &= 0x1f; }
+    else if (c < 0xf0) { k = 3; c &= 0x0f; }
+    else               { k = 4; c = 0; }
 
-    if (c<128) return c;
-    return 0; // XXX
+    while (k--) {
+        if ((n = getByte(p)) < 0) return -1;
+        c = (c << 8) | n;
+    }
+    return c;
 }
 
-static int node (OgdlBinParser p)
+/* A text node is a null terminated array of bytes, the first one
+   (c) already read. Returns 0 if the input ends before its 0. */
+
+static int text_node (OgdlBinParser p, int c)
 {
-	long i;
-	int level, c;
-	
-	/* read the level */
-	p->level = (int) integer(p);
-	if (p->level<=0) return 0;
-	p->level--;
-	
-	/* read the first byte: 0x01 introduces binary node */
-	c = read(p);
-	if ( c <= 0 ) return 0;
-	
-	if ( c == 1 ) 
-	    return binary_node(p);
-	
-	/* UTF-8 text node (XXX what if not?)
-	 * 
-	 * A text node is a null terminated array of bytes.
-	 * 
-	 */
-	 
-	 i=0;
-	 p->buf[i++] = c;
-	 while ((c=read(p))>0) {
-	 	 if (i > BUFFER) break;	/* XXX */
-	     p->buf[i++] = c;
-	 }
-	 p->buf[i] = 0;
-	 p->len = i;
-	
-	(*p->handler)(p,p->level,EVENT_TEXT,p->buf);
+    long i = 0, k, n;
+    unsigned char *s, *e;
+
+    p->buf[i++] = c;
 
-	return 1;
+    for (;;) {
+        if (p->in_pos == p->in_len) {
+            if ((c = fill(p)) <= 0)
+                break;
+            if (!reserve(p,i+2)) return 0;
+            p->buf[i++] = c;
+            continue;
+        }
+
+        s = p->in + p->in_pos;
+        n = p->in_len - p->in_pos;
+        e = memchr(s,0,n);
+        k = e ? e - s : n;
+        if (!reserve(p,i+k+1)) return 0;
+        memcpy(p->buf+i,s,k);
+        i += k;
+        p->in_pos += e ? k+1 : k;
+        if (e) break;
+    }
+    p->buf[i] = 0;
+    p->len = i;
+
+    if (c < 0) return 0;
+    (*p->handler)(p,p->level,EVENT_TEXT,p->buf);
+    return 1;
 }
 
 static int binary_node (OgdlBinParser p)
 {
     /* first byte 0x01 already read */
     
-    long len, i;
+    long len, i = 0, k;
     int c;
     
     while ( (len = integer(p)) > 0)
     {
-	    while (len--) {
-	        c=read(p);
-	 	 	if (i > BUFFER) break;	/* XXX */
-	     	p->buf[i++] = c;
-	 	}    		
+        if (!reserve(p,i+len+1)) return 0;
+
+        while (len) {
+            if (p->in_pos == p->in_len) {
+                if ((c = fill(p)) < 0) return 0;
+                p->buf[i++] = c;
+                len--;
+                continue;
+            }
+            k = p->in_len - p->in_pos;
+            if (k > len) k = len;
+            memcpy(p->buf+i,p->in+p->in_pos,k);
+            p->in_pos += k;
+            i += k;
+            len -= k;
+        }
     }
+    if (len < 0) return 0;
     
+    p->buf[i] = 0;
     p->len = i;
     
     /* level is set in node() */
@@ -167,8 +294,42 @@ static int binary_node (OgdlBinParser p)
     return 1;
 }
 
-Graph OgdlBinParser_parse(OgdlBinParser p)
+static int node (OgdlBinParser p)
+{
+	int c;
+	
+	/* read the level */
+	p->level = (int) integer(p);
+	if (p->level<=0) return 0;
+	p->level--;
+	
+	/* read the first byte: 0x01 introduces binary node */
+	c = getByte(p);
+	if ( c <= 0 ) return 0;
+	
+	if ( c == 1 ) 
+	    return binary_node(p);
+	
+	/* UTF-8 text node (XXX what if not?) */
+	return text_node(p,c);
+}
+
+/* Gives the bytes read ahead to the fd, for what follows the stream
+   in it. Not possible on pipes. */
+
+static void unread(OgdlBinParser p)
 {
+    long n = p->in_len - p->in_pos;
+
+    if (n > 0 && p->src_type == SRC_FD)
+        lseek(p->readfd,-n,SEEK_CUR);
+    p->in_pos = p->in_len = 0;
+}
+
+static Graph parse(OgdlBinParser p)
+{
+    p->skip = -1;
+
     if (node(p))          /* This is the header. The handler skips this first event */
         while (node(p));
 
@@ -176,5 +337,438 @@ Graph OgdlBinParser_parse(OgdlBinParser p)
     return (p && p->g)? p->g[0]:NULL;
 }
 
+Graph OgdlBinParser_parse(OgdlBinParser p)
+{
+    Graph g;
+
+    p->in_pos = p->in_len = 0;
+    g = parse(p);
+    unread(p);
+    return g;
+}
+
+/** Parses the len bytes at buf instead of the input of p. Returns the
+    graph, owned by p as that of OgdlBinParser_parse().
+ */
+
+Graph OgdlBinParser_parseBuffer(OgdlBinParser p, const void *buf, size_t len)
+{
+    unsigned char *in = p->in;
+    long in_size = p->in_size;
+    int src_type = p->src_type;
+    Graph g;
+
+    p->src_type = SRC_BUFFER;
+    p->in = (unsigned char *) buf;
+    p->in_pos = 0;
+    p->in_len = len;
+    p->in_size = 0;
+
+    g = parse(p);
+
+    p->src_type = src_type;
+    p->in = in;
+    p->in_size = in_size;
+    p->in_pos = p->in_len = 0;
+    return g;
+}
+
+/* a multibyte integer at *s, or -1 if the input ends in it */
+
+static long decode(const unsigned char **s, const unsigned char *end)
+{
+    const unsigned char *p = *s;
+    long c;
+    int k;
+
+    if (p == end) return -1;
+    c = *p++;
+
+    if (c >= 0x80) {
+        if (c < 0xc0)      { k = 1; c &= 0x3f; }
+        else if (c < 0xe0) { k = 2; c &= 0x1f; }
+        else if (c < 0xf0) { k = 3; c &= 0x0f; }
+        else               { k = 4; c = 0; }
+
+        if (end - p < k) return -1;
+        while (k--)
+            c = (c << 8) | *p++;
+    }
+    *s = p;
+    return c;
+}
+
+/* the node at *s, as a NUL terminated string in the input if it is
+   one there, and its length in *n; a binary node in several chunks is
+   copied to *copy. NULL if the input ends in it. */
+
+static const char * nodeAt(const unsigned char **s, const unsigned char *end, char **copy, long *copy_size, long *n)
+{
+    const unsigned char *p = *s, *e;
+    long len, size;
+    char *b;
+
+    if (p == end) return 0;
+
+    if (*p != 1) {
+        e = memchr(p,0,end-p);
+        if (!e) return 0;
+        *s = e + 1;
+        *n = e - p;
+        return (const char *) p;
+    }
+
+    /* 0x01 (length bytes)* 0x00: a single chunk is followed by its 0 */
+    p++;
+    *n = 0;
+    if ((len = decode(&p,end)) < 0) return 0;
+    if (!len) {
+        *s = p;
+        return (const char *) p - 1;
+    }
+    if (end - p > len && !p[len]) {
+        *s = p + len + 1;
+        *n = len;
+        return (const char *) p;
+    }
+
+    while (len > 0) {
+        if (end - p < len) return 0;
+        if (*copy_size < *n + len + 1) {
+            for (size = *copy_size ? *copy_size * 2 : BIN_BUFFER; size < *n + len + 1; size *= 2)
+                ;
+            if (!(b = realloc(*copy,size))) return 0;
+            *copy = b;
+            *copy_size = size;
+        }
+        memcpy(*copy + *n,p,len);
+        *n += len;
+        p += len;
+        len = decode(&p,end);
+    }
+    if (len < 0) return 0;
+
+    (*copy)[*n] = 0;
+    *s = p;
+    return *copy;
+}
+
+/* a node for the name of n bytes at name, a binary node if binary is
+   set; in place if ref is set and it can be, else copied, text names
+   cut at BUFFER bytes as OgdlBinParser_parse() does */
+
+static Graph newNode(const char *name, long n, int binary, int ref, const char *copy)
+{
+    Graph node;
+
+    if (!ref || name == copy || !*name)
+        return binary ? Graph_newBytes(name,n) : Graph_newLen((char *) name,n > BUFFER ? BUFFER : n);
+
+    if ((node = Graph_newRef((char *) name)) && binary) {
+        node->flags |= GRAPH_BINARY;
+        node->len = n;
+    }
+    return node;
+}
+
+/* adds the nodes from s to end to root, levels counting from base + 1;
+   stops at a lower level, or where the input is not complete. Frees
+   root and returns NULL if out of memory. */
+
+static Graph decodeNodes(Graph root, const unsigned char *s, const unsigned char *end, long base, int ref)
+{
+    const char *name;
+    char *copy = 0;
+    long level, n, copy_size = 0, skip = -1;
+    int binary;
+    Graph g[LEVELS], node;
+
+    g[0] = root;
+    memset(g+1,0,(LEVELS-1) * sizeof(Graph));
+
+    while ((level = decode(&s,end)) > base) {
+        binary = s < end && *s == 1;
+        if (!(name = nodeAt(&s,end,&copy,&copy_size,&n)))
+            break;
+
+        level -= base + 1;
+
+        /* the nodes below an ignored one are ignored too */
+        if (skip >= 0 && level > skip)
+            continue;
+        skip = -1;
+
+        if (level >= LEVELS-1 || !g[level])
+            break;
+
+        /* comments are ignored, and empty text nodes; binary nodes
+           can be empty */
+        if (!binary && (!n || *name == '#')) {
+            skip = level;
+            continue;
+        }
+
+        node = newNode(name,n,binary,ref,copy);
+        if (!node || Graph_addNode(g[level],node)) {
+            Graph_free(node);
+            Graph_free(g[0]);
+            g[0] = 0;
+            break;
+        }
+        g[level+1] = node;
+    }
+    free(copy);
+    return g[0];
+}
+
+/** Parses the len bytes of binary OGDL at buf without copying them:
+    the names of the nodes point into buf, which must stay as it is
+    while the graph is used (a receive buffer, or a file mapped with
+    mmap()). Only binary nodes in several chunks are copied. As with
+    OgdlBinParser_parse(), the nodes are below a root node, and reading
+    stops at the first node that is not complete or not in place.
+    Returns the graph, to be freed with Graph_free(), or NULL if out of
+    memory.
+ */
+
+Graph OgdlBin_parseBuffer (const void *buf, size_t len)
+{
+    const unsigned char *s = buf, *end = s + len;
+    char *copy = 0;
+    long n, copy_size = 0;
+    Graph root;
+
+    if (!buf) return 0;
+    if (!(root = Graph_new("_root"))) return 0;
+
+    /* the header */
+    if (decode(&s,end) <= 0 || !nodeAt(&s,end,&copy,&copy_size,&n)) {
+        free(copy);
+        return root;
+    }
+    free(copy);
+
+    return decodeNodes(root,s,end,0,1);
+}
+
+/* Indexed binary OGDL, written by OgdlBin_writeIndexed():
+
+     stream  the graph, as OgdlBin_write() writes it
+     index   a stream with the names of the nodes of the first levels
+     table   offset and length in the stream of each of those nodes,
+             in preorder: 8 + 8 bytes
+     footer  offsets of index and table, entries in table, and
+             OGDLBIN_MAGIC: 8 bytes each
+
+   Numbers are little endian. The index is kept as a FrozenGraph, whose
+   node n (in preorder, the root being 0) is entry n-1 of the table. */
+
+struct _OgdlBinIndex {
+    int    fd;
+    FrozenGraph names;      /* the indexed nodes */
+    unsigned char *table;
+    long   count;           /* entries in table */
+};
+
+static unsigned long long getOffset(const unsigned char *b)
+{
+    unsigned long long i = 0;
+    int k;
+
+    for (k=7; k>=0; k--)
+        i = (i << 8) | b[k];
+    return i;
+}
 
+/* n bytes at offset at of fd into buf: a seek and a read */
 
+static int readAt(int fd, void *buf, unsigned long long n, unsigned long long at)
+{
+    char *s = buf;
+    long i;
+
+    if (lseek(fd,(off_t) at,SEEK_SET) == (off_t) -1)
+        return -1;
+
+    while (n) {
+        i = read(fd,s,n);
+        if (i < 0 && errno == EINTR)
+            continue;
+        if (i <= 0)
+            return -1;
+        s += i;
+        n -= i;
+    }
+    return 0;
+}
+
+/** Opens indexed binary OGDL (see OgdlBin_writeIndexed()) in fd, which
+    must be seekable: the index is read, and subtrees are read from fd
+    when asked for. fd stays open, and is not to be used by others
+    while the OgdlBinIndex is. Returns NULL if fd does not end with an
+    index, or if out of memory.
+ */
+
+OgdlBinIndex OgdlBin_openIndexed (int fd)
+{
+    unsigned char footer[OGDLBIN_FOOTER], *buf = 0;
+    unsigned long long size, index_at, table_at, count;
+    OgdlBinIndex x;
+    Graph g = 0;
+    off_t end;
+
+    end = lseek(fd,0,SEEK_END);
+    if (end < OGDLBIN_FOOTER)
+        return 0;
+    size = end - OGDLBIN_FOOTER;
+
+    if (readAt(fd,footer,OGDLBIN_FOOTER,size) || memcmp(footer+24,OGDLBIN_MAGIC,8))
+        return 0;
+
+    index_at = getOffset(footer);
+    table_at = getOffset(footer+8);
+    count = getOffset(footer+16);
+    if (index_at > table_at || table_at > size || (size - table_at) % 16
+        || count != (size - table_at) / 16 || count >= 0x7fffffff)
+        return 0;
+
+    x = calloc(1,sizeof(*x));
+    if (!x) return 0;
+    x->fd = fd;
+    x->count = count;
+
+    x->table = malloc(count * 16 + 1);
+    buf = malloc(table_at - index_at + 1);
+    if (!x->table || !buf
+        || readAt(fd,x->table,count * 16,table_at)
+        || readAt(fd,buf,table_at - index_at,index_at)
+        || !(g = OgdlBin_parseBuffer(buf,table_at - index_at))
+        || !(x->names = Graph_freeze(g))
+        || (unsigned long long) x->names->count != count + 1) {
+        Graph_free(g);
+        free(buf);
+        OgdlBin_closeIndexed(x);
+        return 0;
+    }
+
+    Graph_free(g);
+    free(buf);
+    return x;
+}
+
+/* decodes the subtree of indexed node n, read from fd */
+
+static Graph readSubtree(OgdlBinIndex x, int n)
+{
+    const unsigned char *s, *end;
+    unsigned char *buf;
+    unsigned long long at, len;
+    const char *name;
+    char *copy = 0;
+    long level, size, copy_size = 0;
+    int binary;
+    Graph g = 0;
+
+    at = getOffset(x->table + 16 * (n-1));
+    len = getOffset(x->table + 16 * (n-1) + 8);
+
+    if (!(buf = malloc(len + 1)))
+        return 0;
+    if (readAt(x->fd,buf,len,at)) {
+        free(buf);
+        return 0;
+    }
+
+    /* the node, then those below it */
+    s = buf;
+    end = buf + len;
+    if ((level = decode(&s,end)) > 0) {
+        binary = s < end && *s == 1;
+        if ((name = nodeAt(&s,end,&copy,&copy_size,&size)) && (size || binary)
+            && (g = newNode(name,size,binary,0,copy)))
+            g = decodeNodes(g,s,end,level,0);
+    }
+
+    free(copy);
+    free(buf);
+    return g;
+}
+
+/* takes node out of the node it was added to, which can then be freed
+   without it */
+
+static void detach(Graph node)
+{
+    Graph p = node->store;
+    int i;
+
+    for (i=0; i<p->size; i++)
+        if (p->nodes[i] == node) {
+            memmove(p->nodes+i,p->nodes+i+1,(p->size-i-1) * sizeof(Graph));
+            p->size--;
+            break;
+        }
+    node->store = 0;
+    node->flags &= ~GRAPH_INDEXED;
+}
+
+/** Returns the node at path, with all below it, reading from the fd
+    of x only the subtree of the deepest indexed node on path: a seek
+    and the decoding of that part. The path is made of name, name[n]
+    and .[n] steps. The node is a new graph, to be freed with
+    Graph_free(); NULL if not found.
+ */
+
+Graph OgdlBin_getSubtree (OgdlBinIndex x, char *path)
+{
+    struct _OgdlPath rest;
+    OgdlPath p;
+    Graph g, r;
+    int n = 0, c, k;
+
+    if (!x || !path || !(p = OgdlPath_compile(path)))
+        return 0;
+
+    for (k=0; k<p->nsteps; k++)
+        if (p->steps[k].type != PATH_NAME && p->steps[k].type != PATH_NTH
+            && p->steps[k].type != PATH_INDEX) {
+            OgdlPath_free(p);
+            return 0;
+        }
+
+    for (k=0; k<p->nsteps; k++) {
+        if ((c = FrozenGraph_getStep(x->names,n,p->steps + k)) < 0)
+            break;
+        n = c;
+    }
+
+    if (!n || !(g = readSubtree(x,n))) {
+        OgdlPath_free(p);
+        return 0;
+    }
+
+    /* the rest of the path is below the indexed levels */
+    if (k < p->nsteps) {
+        rest = *p;
+        rest.steps += k;
+        rest.nsteps -= k;
+        if ((r = OgdlPath_eval(&rest,g)))
+            detach(r);
+        Graph_free(g);
+        g = r;
+    }
+
+    OgdlPath_free(p);
+    return g;
+}
+
+/** OgdlBinIndex destructor. The fd is not closed. */
+
+void OgdlBin_closeIndexed (OgdlBinIndex x)
+{
+    if (!x) return;
+
+    FrozenGraph_free(x->names);
+    free(x->table);
+    free(x);
+}
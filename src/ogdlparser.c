@@ -3,6 +3,10 @@
     Non-recursive OGDL parser: character stream to events.
     
     Needs only one consecutive ungetc().
+
+    Input is read in blocks of INPUT_BUFFER bytes (fread() or read())
+    into p->in, and the token scanners copy whole runs from that window
+    instead of going through getChar() for every byte.
     
     Usefull for 8-bit streams that are ASCII transparent,
     such as plain ASCII, ISO-? variants and UTF-8.
@@ -19,10 +23,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#endif
 
 #include "ogdl.h"
 
+/* p->src_type */
+#define SRC_FILE   0
+#define SRC_STRING 1
+#define SRC_FD     2
+#define SRC_PUSH   3
+
 static int line(OgdlParser p);
+static void unpinAll(OgdlParser p, int intern);
 
 static int error(OgdlParser p, int n)
 {
@@ -78,6 +98,10 @@ const char * OgdlParser_getErrorMessage(int n)
             return("No object");
         case ERROR_argumentIsNull:
             return("Null argument exception");
+        case ERROR_write:
+            return("write() failed");
+        case ERROR_shared:
+            return("Node is shared with a snapshot");
         default:
             return("Unknown error");
     }
@@ -102,15 +126,17 @@ void OgdlParser_fatal(OgdlParser p, int n)
 OgdlParser OgdlParser_new()
 {
     OgdlParser p;
+    int i;
     
     p = (void *) malloc(sizeof(*p));
     if (!p) return NULL;
-    
+
     p->level = 0;
     p->line_level = 0;
     p->saved_space = 0;
     p->saved_newline = 0;
-    p->indentation[0] = 0;
+    for (i=0; i<LEVELS; i++)
+        p->indentation[i] = 0;
     p->groupIndex = 0;
     p->g = 0;
     p->handler = (void *) OgdlParser_graphHandler;
@@ -119,6 +145,33 @@ OgdlParser OgdlParser_new()
     p->tabs=-1;
     p->line=0;
     p->is_comment = 0;
+
+    p->in = 0;
+    p->in_pos = 0;
+    p->in_len = 0;
+    p->in_size = 0;
+
+    p->mapped = 0;
+    p->token = -1;
+    p->pending = 0;
+
+    p->push_state = 0;
+    p->push_done = 0;
+
+    for (i=0; i<LEVELS; i++)
+        p->inherited[i] = 0;
+
+    p->buf_len = 0;
+    p->batch = 0;
+    p->ev = 0;
+    p->ev_n = 0;
+    p->ev_text = 0;
+    p->ev_len = p->ev_size = 0;
+
+    p->arena = 0;
+    p->symtab = 0;
+    p->dedup = 0;
+    p->pins = 0;
     
     return p;
 }
@@ -147,16 +200,22 @@ OgdlParser OgdlParser_reuse(OgdlParser p)
     p->groupIndex = 0;
 
     if (p->g) {
-        if (p->g[0])
+        if (p->g[0] && !p->arena)
 	    Graph_free(p->g[0]);
 	free (p->g);
     }
 
     p->g = 0;  	                      
+    unpinAll(p,0);
+    OgdlDedup_clear(p->dedup);
     /* p->handler: maintain the same */
     p->tabs=8;
     p->line=0;
     p->is_comment = 0;
+
+    /* bytes fed but not parsed yet are kept for the next document */
+    p->push_state = 0;
+    p->push_done = 0;
     
     return p;
 }
@@ -165,11 +224,23 @@ OgdlParser OgdlParser_reuse(OgdlParser p)
 
 void OgdlParser_free (OgdlParser p)
 {
+    if (p->in_size)
+        free(p->in);
+
+    if (p->ev) {
+        free(p->ev);
+        free(p->ev_text);
+    }
+
     if (p->g) {
-        if (p->g[0])
+        if (p->g[0] && !p->arena)
 	    Graph_free(p->g[0]);
 	free (p->g);
     }
+
+    unpinAll(p,0);
+    free(p->pins);
+    OgdlDedup_free(p->dedup);
     
     if (p) 
         free(p);
@@ -180,6 +251,84 @@ void OgdlParser_free (OgdlParser p)
 void OgdlParser_setHandler (OgdlParser p, eventHandlerFunction h)
 {
     p->handler = h;
+    p->batch = 0;
+}
+
+/** Delivers the events in batches of up to EVENT_BATCH records to h,
+    instead of one call per event to the event handler. The text of the
+    events of a batch is in one buffer, each record has its offset and
+    length. A batch is delivered when it is full and at the end of
+    OgdlParser_parse(), parseString(), parseFd(), feed() and finish().
+    Returns 0, or ERROR_malloc.
+*/
+
+int OgdlParser_setBatchHandler (OgdlParser p, batchHandlerFunction h)
+{
+    if (!p->ev) {
+        p->ev = malloc(EVENT_BATCH * sizeof(OgdlEvent));
+        p->ev_text = malloc(INPUT_BUFFER);
+        if (!p->ev || !p->ev_text) {
+            free(p->ev);
+            free(p->ev_text);
+            p->ev = 0;
+            p->ev_text = 0;
+            return ERROR_malloc;
+        }
+        p->ev_size = INPUT_BUFFER;
+    }
+    p->batch = h;
+    p->ev_n = 0;
+    p->ev_len = 0;
+    return 0;
+}
+
+/** The graph handler builds the nodes in a (see Graph_newIn()), and
+    the parser does not free them: they are released with the arena.
+    NULL goes back to malloc().
+*/
+
+void OgdlParser_setArena (OgdlParser p, OgdlArena a)
+{
+    p->arena = a;
+}
+
+/** The graph handler interns node names in t (see Graph_newSym()).
+    NULL turns it off.
+*/
+
+void OgdlParser_setSymtab (OgdlParser p, OgdlSymtab t)
+{
+    p->symtab = t;
+}
+
+/** The graph handler makes equal subtrees one shared node as they are
+    read (see Graph_dedup()), so that repeated parts of the document
+    take memory once. The graph is the one Ogdl_load() gives: a node is
+    interned once no node can be added to it any more, and those left
+    when the input ends. Returns 0, or ERROR_malloc.
+*/
+
+int OgdlParser_setDedup (OgdlParser p, int on)
+{
+    if (!on) {
+        unpinAll(p,0);
+        OgdlDedup_free(p->dedup);
+        p->dedup = 0;
+    }
+    else if (!p->dedup && !(p->dedup = OgdlDedup_new()))
+        return ERROR_malloc;
+    return 0;
+}
+
+/** Delivers the events collected so far to the batch handler */
+
+void OgdlParser_flush (OgdlParser p)
+{
+    if (!p->batch || !p->ev_n) return;
+
+    (*p->batch)(p,p->ev_text,p->ev,p->ev_n);
+    p->ev_n = 0;
+    p->ev_len = 0;
 }
 
 /** Changes the default error handler of the parser */
@@ -203,6 +352,112 @@ void OgdlParser_printHandler(OgdlParser p, int lv, int type, char *s)
     puts(s);
 }
 
+/* Ogdl_loadMapped(): the name of a node is the token itself in the
+   mapped file, if p->buf holds the same bytes. The byte that follows it
+   is set to NUL at the next event, when the scanner has gone past it. */
+
+static Graph mappedNode(OgdlParser p)
+{
+    long len = p->buf_len;
+    char *s;
+
+    if (p->pending) {
+        *p->pending = 0;
+        p->pending = 0;
+    }
+
+    if (p->token < 0 || p->token + len > p->in_len
+        || memcmp(p->in + p->token,p->buf,len))
+        return Graph_newLen(p->buf,len);
+
+#ifndef _WIN32
+    /* a token at the very end of a file that fills its last page
+       has no byte left to hold the NUL */
+    if (p->token + len == p->in_len && !(p->in_len % sysconf(_SC_PAGESIZE)))
+        return Graph_newLen(p->buf,len);
+#endif
+
+    s = (char *) p->in + p->token;
+    p->pending = (unsigned char *) s + len;
+    return Graph_newRef(s);
+}
+
+/* With dedup, a node that can still change: it is p->g[level], where
+   the next node of level goes, or has such a node below it. After a
+   comment the next nodes go to p->g[level] even if it is not the last
+   node of the lines before, so all of p->g[] is kept as it is. A node
+   is interned when the last pin at it or below it is let go of, so
+   after the nodes below it. */
+
+struct _OgdlPin {
+    Graph parent;           /* the node it was added to */
+    int   i;                /* its position there */
+    int   refs;             /* p->pins[] at it, and pins below it */
+    struct _OgdlPin *up;    /* the pin of parent, NULL for the root */
+};
+
+/* lets go of x: interns the nodes that are complete then, if intern is
+   set */
+
+static void unpin(OgdlParser p, struct _OgdlPin *x, int intern)
+{
+    struct _OgdlPin *up;
+
+    for (; x && !--x->refs; x = up) {
+        if (intern)
+            OgdlDedup_intern(p->dedup,x->parent,x->i);
+        up = x->up;
+        free(x);
+    }
+}
+
+/* lets go of all the pins: at the end of the input, when the graph is
+   complete (intern set), or when it is dropped */
+
+static void unpinAll(OgdlParser p, int intern)
+{
+    int i;
+
+    if (!p->pins) return;
+
+    for (i=LEVELS-1; i>0; i--) {
+        unpin(p,p->pins[i],intern);
+        p->pins[i] = 0;
+        if (intern && p->g)
+            p->g[i] = 0;
+    }
+}
+
+/* pins g, just added to p->g[level]; the node it replaces as p->g[level+1]
+   is let go of */
+
+static void pin(OgdlParser p, int level, Graph g)
+{
+    Graph parent = p->g[level];
+    struct _OgdlPin *x = 0;
+
+    if (!p->pins)
+        p->pins = calloc(LEVELS,sizeof(p->pins[0]));
+
+    if (g && parent->size && parent->nodes[parent->size-1] == g) {
+        if (!p->pins || !(x = malloc(sizeof(*x)))) {
+            /* go on without sharing */
+            error(p,ERROR_malloc);
+            OgdlParser_setDedup(p,0);
+            return;
+        }
+        x->parent = parent;
+        x->i = parent->size-1;
+        x->refs = 1;
+        x->up = p->pins[level];
+        if (x->up)
+            x->up->refs++;
+    }
+
+    unpin(p,p->pins[level+1],1);
+    p->pins[level+1] = x;
+}
+
 /** An event handler that creates a Graph nested structure holding
     the entire OGDL stream.
     
@@ -219,7 +474,7 @@ void OgdlParser_graphHandler(OgdlParser p, int level, int type, char *s)
     if (!type) return;
     
     /* empty nodes are ignored */
-    if (!strlen(p->buf)) return;
+    if (!p->buf_len) return;
 
     /* comments are ignored */
     if (p->buf[0] == '#') return;
@@ -230,7 +485,8 @@ void OgdlParser_graphHandler(OgdlParser p, int level, int type, char *s)
         if (!p->g) { error(p,ERROR_malloc); return; }
         for (i=1; i<LEVELS; i++)
             p->g[i]=0;
-        p->g[0] = Graph_new("__root__");
+        p->g[0] = p->arena ? Graph_newIn(p->arena,"__root__")
+                           : Graph_new("__root__");
     }
     
     /* sanity checks */
@@ -239,15 +495,59 @@ void OgdlParser_graphHandler(OgdlParser p, int level, int type, char *s)
     if (p->g[level] == NULL) { error(p,ERROR_nullGraph); return; }
 
     /* create a new node and add it to current level */
-    g = Graph_new(p->buf);
+    if (p->mapped)
+        g = mappedNode(p);
+    else if (p->symtab)
+        g = Graph_newSym(p->symtab,p->arena,p->buf,p->buf_len);
+    else if (p->arena)
+        g = Graph_newLenIn(p->arena,p->buf,p->buf_len);
+    else
+        g = Graph_newLen(p->buf,p->buf_len);
     Graph_addNode(p->g[level],g);
     p->g[level+1]=g;
 
+    if (p->dedup)
+        pin(p,level,g);
+}
+
+/* in batch mode the event is added to p->ev, and its text to p->ev_text */
+
+static void batchEvent(OgdlParser p, int type, char *s)
+{
+    long len = (s == p->buf) ? p->buf_len : (long) strlen(s);
+    long size;
+    char *t;
+    OgdlEvent *ev;
+
+    if (p->ev_n == EVENT_BATCH || p->ev_len + len + 1 > p->ev_size)
+        OgdlParser_flush(p);
+
+    if (len + 1 > p->ev_size) {
+        size = p->ev_size;
+        while (size < len + 1)
+            size *= 2;
+        t = realloc(p->ev_text,size);
+        if (!t) { error(p,ERROR_realloc); return; }
+        p->ev_text = t;
+        p->ev_size = size;
+    }
+
+    ev = p->ev + p->ev_n++;
+    ev->level = p->level;
+    ev->type = type;
+    ev->offset = p->ev_len;
+    ev->length = len;
+    memcpy(p->ev_text + p->ev_len,s,len);
+    p->ev_text[p->ev_len + len] = 0;
+    p->ev_len += len + 1;
 }
 
 static void event(OgdlParser p, int type, char *s)
 {
-    (*p->handler)(p,p->level,type,s);
+    if (p->batch)
+        batchEvent(p,type,s);
+    else
+        (*p->handler)(p,p->level,type,s);
 }
 
 /* Character classes:
@@ -278,25 +578,236 @@ static int _charType ( int c )
 
 /* Character input functions */
 
-static int getChar(OgdlParser p)
+/* Refill p->in from the file or fd. Returns the first byte of the new
+   window, or EOF. A string source is never refilled: its end is EOF. */
+
+static int fill(OgdlParser p)
 {
-    if (p->src_type) 
-        return ((char*)p->src)[p->src_index++];
+    long n = 0;
+
+    if (p->src_type == SRC_STRING || p->src_type == SRC_PUSH)
+        return p->last_char = EOF;
+
+    if (!p->in_size) {
+        p->in = malloc(INPUT_BUFFER);
+        if (!p->in) { error(p,ERROR_malloc); return p->last_char = EOF; }
+        p->in_size = INPUT_BUFFER;
+    }
+
+    if (p->src_type == SRC_FILE)
+        n = fread(p->in,1,p->in_size,(FILE*)p->src);
     else
-        return p->last_char = getc((FILE*)p->src);
+        n = read(p->src_fd,p->in,p->in_size);
+
+    p->in_pos = 0;
+    p->in_len = n > 0 ? n : 0;
+
+    if (!p->in_len)
+        return p->last_char = EOF;
+
+    return p->last_char = p->in[p->in_pos++];
+}
+
+static int getChar(OgdlParser p)
+{
+    if (p->in_pos < p->in_len)
+        return p->last_char = p->in[p->in_pos++];
+    return fill(p);
 }
 
 static void unGetChar(OgdlParser p)
 {
-    if (p->src_type)
-        p->src_index--;
-    else
-        if (p->last_char != EOF)		/* XXX is this compatible with EOS ? */
-            ungetc(p->last_char,(FILE*)p->src);
+    if (p->last_char != EOF)		/* XXX is this compatible with EOS ? */
+        p->in_pos--;
 }
 
+/* Give the bytes read ahead but not parsed back to the file or fd, so
+   that a stream holding several documents (see OgdlLog) can be read
+   on. Not possible on pipes. */
+
+static void unread(OgdlParser p)
+{
+    long n = p->in_len - p->in_pos;
+
+    if (n <= 0) return;
+
+    if (p->src_type == SRC_FILE)
+        fseek((FILE*)p->src,-n,SEEK_CUR);
+    else if (p->src_type == SRC_FD)
+        lseek(p->src_fd,-n,SEEK_CUR);
+
+    p->in_pos = p->in_len = 0;
+}
+
+/* Token scanners. Each returns the length of the run at the start of
+   s[0..n) that a token loop can copy without looking at it:
+
+     scanWord   : word characters (class C_WORD)
+     scanQuoted : anything but the quote character q and '\n'
+
+   The SSE2 and AVX2 versions test 16 or 32 bytes per step; the one to
+   use is chosen once, as the program starts, by scanInit(). Comments (class < C_BREAK),
+   indentation in space() (short) and the line loop in block() (memchr())
+   are not dispatched. */
+
+static long scanClass(const unsigned char *s, long n, int lv)
+{
+    long i;
+
+    for (i=0; i<n; i++)
+        if (_charType(s[i]) >= lv)
+            break;
+    return i;
+}
+
+static long scanWord_c(const unsigned char *s, long n)
+{
+    return scanClass(s,n,C_SPACE);
+}
+
+static long scanQuoted_c(const unsigned char *s, long n, int q)
+{
+    long i;
+
+    for (i=0; i<n; i++)
+        if (s[i] == q || s[i] == '\n')
+            break;
+    return i;
+}
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+
+#define OGDL_SIMD
+#include <immintrin.h>
+
+/* bytes <= 0x20 (controls and space) or in 0x7f..0x9f end a word */
+
+static long scanWord_sse2(const unsigned char *s, long n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c20 = _mm_set1_epi8(0x20);
+    const __m128i c7f = _mm_set1_epi8(0x7f);
+    __m128i x, lo, hi;
+    long i;
+    int m;
+
+    for (i=0; i+16<=n; i+=16) {
+        x = _mm_loadu_si128((const __m128i *)(s+i));
+        lo = _mm_cmpeq_epi8(_mm_subs_epu8(x,c20),zero);
+        hi = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(x,c7f),c20),zero);
+        m = _mm_movemask_epi8(_mm_or_si128(lo,hi));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + scanWord_c(s+i,n-i);
+}
+
+static long scanQuoted_sse2(const unsigned char *s, long n, int q)
+{
+    const __m128i vq = _mm_set1_epi8((char) q);
+    const __m128i nl = _mm_set1_epi8('\n');
+    __m128i x;
+    long i;
+    int m;
+
+    for (i=0; i+16<=n; i+=16) {
+        x = _mm_loadu_si128((const __m128i *)(s+i));
+        m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x,vq),
+                                           _mm_cmpeq_epi8(x,nl)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + scanQuoted_c(s+i,n-i,q);
+}
+
+#ifdef __x86_64__
+
+#define OGDL_AVX2
+
+__attribute__((target("avx2")))
+static long scanWord_avx2(const unsigned char *s, long n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c20 = _mm256_set1_epi8(0x20);
+    const __m256i c7f = _mm256_set1_epi8(0x7f);
+    __m256i x, lo, hi;
+    long i;
+    unsigned m;
+
+    for (i=0; i+32<=n; i+=32) {
+        x = _mm256_loadu_si256((const __m256i *)(s+i));
+        lo = _mm256_cmpeq_epi8(_mm256_subs_epu8(x,c20),zero);
+        hi = _mm256_cmpeq_epi8(_mm256_subs_epu8(_mm256_sub_epi8(x,c7f),c20),zero);
+        m = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(lo,hi));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + scanWord_sse2(s+i,n-i);
+}
+
+__attribute__((target("avx2")))
+static long scanQuoted_avx2(const unsigned char *s, long n, int q)
+{
+    const __m256i vq = _mm256_set1_epi8((char) q);
+    const __m256i nl = _mm256_set1_epi8('\n');
+    __m256i x;
+    long i;
+    unsigned m;
+
+    for (i=0; i+32<=n; i+=32) {
+        x = _mm256_loadu_si256((const __m256i *)(s+i));
+        m = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x,vq),
+                                                            _mm256_cmpeq_epi8(x,nl)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + scanQuoted_sse2(s+i,n-i,q);
+}
+
+#endif /* __x86_64__ */
+#endif /* __SSE2__ */
+
+#ifdef OGDL_SIMD
+static long (*scanWord)(const unsigned char *s, long n) = scanWord_sse2;
+static long (*scanQuoted)(const unsigned char *s, long n, int q) = scanQuoted_sse2;
+#else
+static long (*scanWord)(const unsigned char *s, long n) = scanWord_c;
+static long (*scanQuoted)(const unsigned char *s, long n, int q) = scanQuoted_c;
+#endif
+
+#ifdef OGDL_AVX2
+
+/* run before main(), so before any parser and any thread: the scanners
+   are not written while they are used */
+
+static void scanInit(void) __attribute__((constructor));
+
+static void scanInit(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanWord = scanWord_avx2;
+        scanQuoted = scanQuoted_avx2;
+    }
+}
+#endif
+
 /* character classes */
 
+/* p->indentation[level]. A parser of Ogdl_loadParallel() starts with
+   -1 for the levels that lines before its start may have set. It takes
+   them as 0 and notes which ones it used; its result is good if that
+   is what they were. */
+
+static int indentation(OgdlParser p, int level)
+{
+    if (p->indentation[level] < 0) {
+        p->inherited[level] = 1;
+        return 0;
+    }
+    return p->indentation[level];
+}
+
 static int isCharSpace(int c)
 {
     return ((c == ' ') || (c == '\t')) ? 1 : 0;
@@ -348,6 +859,7 @@ static int space(OgdlParser p, int check)
 static int space(OgdlParser p, int check)
 {
     int c, i, tabs=0, sps=0;
+    unsigned char *s, *e;
 
     if (p->saved_space > 0) {
         i = p->saved_space;
@@ -355,7 +867,21 @@ static int space(OgdlParser p, int check)
         return i;
     }
 
-    i = 0;
+    /* blanks inside the input window (indentation is short: no scanner) */
+    s = p->in + p->in_pos;
+    e = p->in + p->in_len;
+    while (s < e) {
+        if (*s == ' ')
+            sps++;
+        else if (*s == '\t')
+            tabs++;
+        else
+            break;
+        s++;
+    }
+    i = sps + tabs;
+    p->in_pos += i;
+
     while (1) {
         c = getChar(p);
         if (c == ' ') {
@@ -432,10 +958,25 @@ static int eos(OgdlParser p)
 static int word(OgdlParser p)
 {
     int c, t, i = 0, lv = C_SPACE;
+    long n;
 
     if ( p->is_comment ) lv = C_BREAK;
 
+    p->token = p->in_pos;
+
     while (1) {
+        /* copy a run of plain characters straight from the input window */
+        if (lv == C_SPACE)
+            n = scanWord(p->in + p->in_pos, p->in_len - p->in_pos);
+        else
+            n = scanClass(p->in + p->in_pos, p->in_len - p->in_pos, lv);
+        if (n) {
+            if (i+n>=BUFFER) { error(p,ERROR_textOverflow1); return -9; }
+            memcpy(p->buf+i,p->in+p->in_pos,n);
+            i += n;
+            p->in_pos += n;
+        }
+
         c = getChar(p);
         t = _charType(c);
 	if ((i == 1) && (t == C_SPACE) && (p->buf[0]=='#')) 
@@ -452,6 +993,7 @@ static int word(OgdlParser p)
 
     if (i>=BUFFER) { error(p,ERROR_textOverflow2); return -9; }
     p->buf[i] = 0;
+    p->buf_len = i;
     unGetChar(p);
     
     /* If this was a comment, we don't actually return it */
@@ -472,8 +1014,7 @@ static int word(OgdlParser p)
 static int quoted(OgdlParser p)
 {
     int i=0, q, c, cc=0, flag = 0, n;
-
-    n  = p->indentation[p->level];
+    long m;
 
     q = getChar(p);
 
@@ -482,7 +1023,22 @@ static int quoted(OgdlParser p)
         return 0;
     }
 
+    n  = indentation(p,p->level);
+
+    p->token = p->in_pos;
+
     while (1) {
+        if (!flag) {
+            m = scanQuoted(p->in + p->in_pos, p->in_len - p->in_pos, q);
+            if (m) {
+                if (i+m>=BUFFER) { error(p,ERROR_textOverflow3); return -9; }
+                memcpy(p->buf+i,p->in+p->in_pos,m);
+                i += m;
+                p->in_pos += m;
+                cc = p->buf[i-1];
+            }
+        }
+
         c = getChar(p);
         if ((c == -1) || (c == q && cc != '\\'))
             break;
@@ -506,6 +1062,7 @@ static int quoted(OgdlParser p)
 
     if (i>=BUFFER) { error(p,ERROR_textOverflow4); return -9; }
     p->buf[i] = 0;
+    p->buf_len = i;
 
     return 1;
 }
@@ -521,6 +1078,8 @@ static int quoted(OgdlParser p)
 static int block(OgdlParser p, int n)
 {
     int c, i = 0, j, m, ind = -1;
+    long k;
+    unsigned char *e;
 
     c = getChar(p);
 
@@ -532,6 +1091,8 @@ static int block(OgdlParser p, int n)
     if (!newline(p))
         return 0;   /* illegal or we need 2 ungetc's */
 
+    p->token = -1;
+
     /* all lines indented at least n are this block, and also less indented empty lines */
 
     for (;;) {
@@ -547,12 +1108,26 @@ static int block(OgdlParser p, int n)
                 break;
             }
         } else {
-            if (ind < 0)
+            if (ind < 0) {
                 ind = m;                /* set ind to the indentation level of the first line */
+                p->token = p->in_pos;
+            }
             if (i>=BUFFER) { error(p,ERROR_textOverflow6); return -9; }
             for (j = ind; j < m; j++)     /* add those spaces that are not indentation */
                 p->buf[i++] = ' ';
             while (1) {
+                /* the rest of the line up to '\n' in one go */
+                k = p->in_len - p->in_pos;
+                e = memchr(p->in + p->in_pos,'\n',k);
+                if (e)
+                    k = e - (p->in + p->in_pos);
+                if (k) {
+                    if (i+k>=BUFFER) { error(p,ERROR_textOverflow7); return -9; }
+                    memcpy(p->buf+i,p->in+p->in_pos,k);
+                    i += k;
+                    p->in_pos += k;
+                }
+
                 c = getChar(p);
                 if (i>=BUFFER) { error(p,ERROR_textOverflow7); return -9; }
                 if (c == EOF || c == '\n') {
@@ -569,16 +1144,17 @@ static int block(OgdlParser p, int n)
 
     if (i>=BUFFER) { error(p,ERROR_textOverflow8); return -9; }
     p->buf[i] = 0;
+    p->buf_len = i;
     
     /* chomp (eliminate last break) */
     i--;
-    if (i<0) return 1;
+    if (i<1) return 1;
     if (isCharBreak(p->buf[i-1]))
-        p->buf[i]=0;
+        p->buf[p->buf_len = i]=0;
     i--;
-    if (i<0) return 1;
+    if (i<1) return 1;
     if (isCharBreak(p->buf[i-1]))
-        p->buf[i]=0;    
+        p->buf[p->buf_len = i]=0;    
     
     return 1;
 }
@@ -616,7 +1192,8 @@ static int table (OgdlParser p, int n)
                 break;
             }
         } else {
-            sprintf(p->buf,"%d",i);
+            p->buf_len = sprintf(p->buf,"%d",i);
+            p->token = -1;
             event(p,1, p->buf);
             lev=p->level++;
             p->line_level=lev+1;
@@ -647,7 +1224,7 @@ static int node(OgdlParser p)
     /* block indentation starts at current line indentation + 1, 
        not the indentation of the last node on the line. */
     
-    j = block(p,p->indentation[p->line_level]+1); 
+    j = block(p,indentation(p,p->line_level)+1); 
     if (j<0) return -9;
     
     if (j) {
@@ -655,7 +1232,7 @@ static int node(OgdlParser p)
         return -1;
     }
 
-    j = table(p,p->indentation[p->line_level]+1); 
+    j = table(p,indentation(p,p->line_level)+1); 
     if (j<0) return -9;
     
     if (j) {
@@ -671,7 +1248,7 @@ static int node(OgdlParser p)
         if (!j || j==-9) return j;
     }
     
-    len = strlen(p->buf);
+    len = p->buf_len;
     if (!len) 
         strcpy(p->buf,"''");    /* avoid error */
     else 
@@ -695,7 +1272,7 @@ static int node(OgdlParser p)
     }
 
     if ( i == ',' )
-        p->buf[--len] = 0;
+        p->buf[p->buf_len = --len] = 0;
     
     if (len != 0)
         event(p,1, p->buf);
@@ -734,16 +1311,16 @@ static int line(OgdlParser p)
         p->line_level=0;
     }
     else {
-        if ( i > p->indentation[p->line_level] ) {
+        if ( i > indentation(p,p->line_level) ) {
             p->line_level++;
             if (p->line_level>=LEVELS)
                 { error(p,ERROR_maxLevels2); return 0; }
             p->indentation[p->line_level] = i;
         }
         else {
-            if ( i < p->indentation[p->line_level] ) {
+            if ( i < indentation(p,p->line_level) ) {
                 while (p->line_level > 0) {
-                    if ( i >= p->indentation[p->line_level] )
+                    if ( i >= indentation(p,p->line_level) )
                         break;
                     p->line_level--;  
                 }
@@ -767,17 +1344,330 @@ static int line(OgdlParser p)
 int OgdlParser_parse (OgdlParser p, FILE *f)
 {
     p->src = f;
-    p->src_type = 0;	/* file */
+    p->src_type = SRC_FILE;
+    p->in_pos = p->in_len = 0;
+    while ( line(p) );
+    unread(p);
+    OgdlParser_flush(p);
+    unpinAll(p,1);
+    return 0;
+}
+
+/** Parse from a file descriptor, reading INPUT_BUFFER bytes at a time. */
+
+int OgdlParser_parseFd (OgdlParser p, int fd)
+{
+    p->src = 0;
+    p->src_fd = fd;
+    p->src_type = SRC_FD;
+    p->in_pos = p->in_len = 0;
     while ( line(p) );
+    unread(p);
+    OgdlParser_flush(p);
+    unpinAll(p,1);
     return 0;
 }
 
 int OgdlParser_parseString (OgdlParser p, char *s)
 {
+    if (p->in_size) {
+        free(p->in);
+        p->in_size = 0;
+    }
+
     p->src = s;
-    p->src_type = 1;	/* string */
+    p->src_type = SRC_STRING;
     p->src_index = 0;
+    p->in = (unsigned char *) s;
+    p->in_pos = 0;
+    p->in_len = strlen(s);
     while ( line(p) );
+    OgdlParser_flush(p);
+    unpinAll(p,1);
+    p->src_index = p->in_pos;
+    p->in = 0;
+    p->in_pos = p->in_len = 0;
+    return 0;
+}
+
+/* Push parsing.
+
+   line() pulls its input, so OgdlParser_feed() only calls it when the
+   input window holds everything it is going to read: one physical line,
+   or for a line that opens a block or a table ('\' or '|' at the end),
+   all the lines of the block up to the first non-empty line indented
+   less than the block, or a quoted string that goes on over several
+   lines. unitReady() finds that out, resuming where the previous feed
+   left off so that no byte is scanned twice.
+
+   The rows of a table are scanned as lines are, for quoted strings.
+   A block or table inside a table ends where the indentation that
+   line() has for the row says, which the scanner does not know: the
+   unit then goes on up to the first non-empty line that is not
+   indented, which ends them all. If quote characters follow such a
+   block, there is no telling whether they are in it: the unit is then
+   everything up to OgdlParser_finish(). */
+
+enum {
+    U_START,        /* at the start of a unit */
+    U_INDENT,       /* indentation of the first line */
+    U_CR,           /* a '\r': newline() looks at one more byte */
+    U_TOKEN,        /* before a token */
+    U_WORD,
+    U_HASH,         /* a '#' at the start of a token */
+    U_COMMENT,
+    U_QUOTE,
+    U_OPEN,         /* '\' or '|' at the start of a token */
+    U_BODY_INDENT,  /* indentation of a block or table line */
+    U_BODY_LINE
+};
+
+enum {
+    T_NONE,         /* not in a table */
+    T_ROWS,         /* in the rows of a table */
+    T_NESTED,       /* in a block or table inside a table */
+    T_FINISH        /* quotes after it: up to OgdlParser_finish() */
+};
+
+/* The indentation that line() will take as the line level for a line
+   indented i, without changing the parser state */
+
+static int lineIndent(OgdlParser p, int i)
+{
+    int l = p->line_level;
+
+    if (p->level == 0 || i > indentation(p,l))
+        return i;
+
+    while (l > 0 && i < indentation(p,l))
+        l--;
+    return indentation(p,l);
+}
+
+static int unitReady(OgdlParser p)
+{
+    unsigned char *s = p->in;
+    long i;
+    int c;
+
+    if (p->push_state == U_START) {
+        p->push_pos = p->in_pos;
+        p->push_ind = p->saved_space > 0 ? p->saved_space : 0;
+        p->push_table = T_NONE;
+        p->push_state = U_INDENT;
+    }
+
+    if (p->push_table == T_FINISH)
+        return 0;
+
+    for (i=p->push_pos; i<p->in_len; i++) {
+        c = s[i];
+
+        switch (p->push_state) {
+
+        case U_INDENT:
+            if (c == ' ' || c == '\t') {
+                p->push_ind++;
+                break;
+            }
+            if (c == '\r') {
+                p->push_state = U_CR;
+                break;
+            }
+            if (c == '\n' || _charType(c) == C_END)
+                goto ready;
+            p->push_n = lineIndent(p,p->push_ind) + 1;
+            p->push_state = U_TOKEN;
+            i--;
+            break;
+
+        case U_CR:
+            goto ready;
+
+        case U_TOKEN:
+            if (c == ' ' || c == '\t')
+                break;
+            if (p->push_table && _charType(c) == C_BREAK) {
+                p->push_m = 0;          /* the end of a row */
+                p->push_state = U_BODY_INDENT;
+                break;
+            }
+            if (_charType(c) >= C_BREAK)
+                goto ready;
+            if (c == '"' || c == '\'') {
+                p->push_q = c;
+                p->push_prev = 0;
+                p->push_state = U_QUOTE;
+            }
+            else if (c == '\\' || c == '|') {
+                p->push_q = c;
+                p->push_state = U_OPEN;
+            }
+            else if (c == '#')
+                p->push_state = U_HASH;
+            else
+                p->push_state = U_WORD;
+            break;
+
+        case U_HASH:
+            if (c == ' ' || c == '\t') {
+                p->push_state = U_COMMENT;
+                break;
+            }
+            p->push_state = U_WORD;
+            /* fall through */
+
+        case U_WORD:
+            if (_charType(c) != C_WORD) {
+                p->push_state = U_TOKEN;
+                i--;
+            }
+            break;
+
+        case U_COMMENT:
+            if (_charType(c) >= C_BREAK) {
+                p->push_state = U_TOKEN;
+                i--;
+            }
+            break;
+
+        case U_QUOTE:
+            if (c == p->push_q && p->push_prev != '\\')
+                p->push_state = U_TOKEN;
+            p->push_prev = c;
+            break;
+
+        case U_OPEN:
+            if (c == '\n' || c == '\r') {
+                if (p->push_table)
+                    p->push_table = T_NESTED;
+                else if (p->push_q == '|')
+                    p->push_table = T_ROWS;
+                p->push_m = 0;
+                p->push_state = U_BODY_INDENT;
+            }
+            else {
+                p->push_state = U_WORD;
+                i--;
+            }
+            break;
+
+        case U_BODY_INDENT:
+            if (c == ' ' || c == '\t')
+                p->push_m++;
+            else if (c == '\n' || c == '\r')
+                p->push_m = 0;          /* empty lines belong to the block */
+            else if (p->push_table == T_NESTED ? !p->push_m : p->push_m < p->push_n)
+                goto ready;             /* the first line after it */
+            else if (p->push_table == T_ROWS) {
+                p->push_state = U_TOKEN;
+                i--;
+            }
+            else {
+                p->push_state = U_BODY_LINE;
+                i--;
+            }
+            break;
+
+        case U_BODY_LINE:
+            if (c == '\n') {
+                p->push_m = 0;
+                p->push_state = U_BODY_INDENT;
+            }
+            else if (p->push_table == T_NESTED && (c == '"' || c == '\'')) {
+                p->push_table = T_FINISH;
+                return 0;
+            }
+            break;
+        }
+    }
+
+    p->push_pos = i;
+    return 0;
+
+ready:
+    p->push_state = U_START;
+    return 1;
+}
+
+/** Push parsing: append len bytes of input and parse every line that
+    is complete. Events go to the handler as with OgdlParser_parse().
+    The bytes of an incomplete line are kept until the next call.
+
+    Returns 1 when the end of the stream (OGDL_EOS) has been reached,
+    0 otherwise. After OgdlParser_reuse() the bytes that followed the
+    OGDL_EOS are parsed as the next document.
+*/
+
+int OgdlParser_feed (OgdlParser p, char *s, long len)
+{
+    long n, size;
+    unsigned char *in;
+
+    if (p->src_type != SRC_PUSH) {
+        if (!p->in_size)
+            p->in = 0;
+        p->in_pos = p->in_len = 0;
+        p->src = 0;
+        p->src_type = SRC_PUSH;
+        p->push_state = U_START;
+        p->push_done = 0;
+    }
+
+    /* drop what has been parsed */
+    if (p->in_pos) {
+        n = p->in_len - p->in_pos;
+        memmove(p->in,p->in + p->in_pos,n);
+        if (p->push_state != U_START)
+            p->push_pos -= p->in_pos;
+        p->in_pos = 0;
+        p->in_len = n;
+    }
+
+    if (p->in_len + len > p->in_size) {
+        size = p->in_size ? p->in_size : INPUT_BUFFER;
+        while (size < p->in_len + len)
+            size *= 2;
+        in = realloc(p->in,size);
+        if (!in) { error(p,ERROR_realloc); return 1; }
+        p->in = in;
+        p->in_size = size;
+    }
+
+    if (len > 0) {
+        memcpy(p->in + p->in_len,s,len);
+        p->in_len += len;
+    }
+
+    /* like OgdlLog_next(), tolerate a document beginning with EOS */
+    if (!p->line && p->push_state == U_START && p->in_pos < p->in_len
+        && p->in[p->in_pos] == OGDL_EOS)
+        p->in_pos++;
+
+    while (!p->push_done && unitReady(p))
+        if (!line(p))
+            p->push_done = 1;
+
+    OgdlParser_flush(p);
+    if (p->push_done)
+        unpinAll(p,1);
+    return p->push_done;
+}
+
+/** End of push input: parse what is left as the end of the stream */
+
+int OgdlParser_finish (OgdlParser p)
+{
+    if (p->src_type != SRC_PUSH)
+        return 0;
+
+    while (!p->push_done)
+        if (!line(p))
+            p->push_done = 1;
+
+    OgdlParser_flush(p);
+    unpinAll(p,1);
+    p->push_state = U_START;
     return 0;
 }
 
@@ -803,9 +1693,344 @@ Graph Ogdl_load (char * file)
     /* free the parser but not the graph */
     if (p->g) {
         g = p->g[0];
-        free (p->g);
+        p->g[0] = NULL;
     }
-    free(p);    
+    OgdlParser_free(p);
     
     return g;
 }
+
+/** Load a file through a private memory mapping. Node names that appear
+    verbatim in the file point into the mapping instead of being copied;
+    only unescaped or re-indented text (quoted strings over several lines,
+    blocks) is copied. The mapping is released by Graph_free() on the
+    returned graph.
+*/
+
+Graph Ogdl_loadMapped (char * file)
+{
+#ifdef _WIN32
+    return Ogdl_load(file);
+#else
+    OgdlParser p;
+    OgdlMap map;
+    Graph g=0;
+    struct stat st;
+    void *addr;
+    int fd;
+
+    fd = open(file,O_RDONLY);
+    if (fd < 0) return 0;
+
+    if (fstat(fd,&st) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+
+    addr = mmap(0,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (addr == MAP_FAILED) return 0;
+
+    map = malloc(sizeof(*map));
+    p = OgdlParser_new();
+    if (!p || !map) {
+        munmap(addr,st.st_size);
+        free(map);
+        if (p) free(p);
+        return 0;
+    }
+    map->addr = addr;
+    map->len = st.st_size;
+
+    p->src = addr;
+    p->src_type = SRC_STRING;
+    p->in = addr;
+    p->in_len = st.st_size;
+    p->mapped = 1;
+
+    while ( line(p) );
+
+    if (p->pending)
+        *p->pending = 0;
+    p->in = 0;
+
+    if (p->g) {
+        g = p->g[0];
+        p->g[0] = NULL;
+    }
+    OgdlParser_free(p);
+
+    if (!g) {
+        munmap(addr,st.st_size);
+        free(map);
+        return 0;
+    }
+
+    g->flags |= GRAPH_MAPPED;
+    g->store = map;
+    return g;
+#endif
+}
+
+#ifndef _WIN32
+
+/* Ogdl_loadParallel(): one chunk of the file, parsed by its own thread
+   from splits[k] on. A chunk parser stops at the first split where it
+   lands on a line boundary in a state that a new parser would also
+   have there; stop is the index of that split, or -1 if it parsed to
+   the end (or to an OGDL_EOS). */
+
+#define CHUNK_ERRORS 16
+
+typedef struct {
+    OgdlParser p;
+    long *splits;
+    int  nsplits;
+    int  next;      /* the first split where the parser may stop */
+    int  stop;
+    int  line;      /* p->line there */
+    int  orphan;    /* a node had no parent: the lines before the split
+                       may have left it one (see graphHandler) */
+    int  nerrors;   /* errors are reported only if the chunk is used */
+    int  error[CHUNK_ERRORS];
+    int  error_line[CHUNK_ERRORS];
+} ParseChunk;
+
+/* error handler of the chunk parsers; p->src is the ParseChunk */
+
+static void chunkError(OgdlParser p, int n)
+{
+    ParseChunk *c = p->src;
+
+    if (n == ERROR_nullGraph)
+        c->orphan = 1;
+    if (c->nerrors < CHUNK_ERRORS) {
+        c->error[c->nerrors] = n;
+        c->error_line[c->nerrors++] = p->line;
+    }
+}
+
+static void *parseChunk(void *arg)
+{
+    ParseChunk *c = arg;
+    OgdlParser p = c->p;
+    int next = c->next;
+
+    c->stop = -1;
+
+    while ( line(p) ) {
+        while (next < c->nsplits && p->in_pos > c->splits[next])
+            next++;
+        if (next < c->nsplits && p->in_pos == c->splits[next]
+            && !p->saved_space && !p->groupIndex
+            && p->level >= 0 && p->line_level >= 0
+            && (!p->level || !p->indentation[0])) {
+            c->stop = next;
+            break;
+        }
+    }
+    c->line = p->line;
+    return 0;
+}
+
+/* move the top level nodes of a chunk's graph to g */
+
+static void splice(Graph g, OgdlParser p)
+{
+    Graph r;
+    int i;
+
+    if (!p->g || !(r = p->g[0]))
+        return;
+
+    for (i=0; i<r->size; i++)
+        Graph_addNode(g,r->nodes[i]);
+    r->size = 0;
+    Graph_free(r);
+    p->g[0] = NULL;
+}
+
+#endif
+
+/** Load a file using nthreads threads (all processors if nthreads < 1).
+
+    The file is split at lines with no indentation, and each part is
+    parsed by its own thread. A split point can turn out to be inside a
+    quoted string or to follow a line that left the parser in another
+    state; the preceding part then simply goes on parsing past it, and
+    the part that started there is discarded. The result is the same
+    graph as Ogdl_load() gives.
+
+    Line numbers in error messages are those of the file, as with
+    Ogdl_load().
+*/
+
+Graph Ogdl_loadParallel (char * file, int nthreads)
+{
+#ifdef _WIN32
+    return Ogdl_load(file);
+#else
+    ParseChunk *chunk;
+    pthread_t *th;
+    long *splits, len, pos;
+    char *s;
+    struct stat st;
+    Graph g=0;
+    int fd, i, j, k, n, tabs, line0;
+    int indent[LEVELS];
+
+    if (nthreads < 1)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+
+    fd = open(file,O_RDONLY);
+    if (fd < 0) return 0;
+
+    if (fstat(fd,&st) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+    len = st.st_size;
+
+    s = mmap(0,len,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (s == MAP_FAILED) return 0;
+
+    /* split points: the start of a non-empty line with no indentation
+       after each len/nthreads bytes */
+
+    splits = malloc(sizeof(long) * nthreads);
+    chunk = malloc(sizeof(ParseChunk) * nthreads);
+    th = malloc(sizeof(pthread_t) * nthreads);
+    if (!splits || !chunk || !th) {
+        free(splits); free(chunk); free(th);
+        munmap(s,len);
+        return 0;
+    }
+
+    n = 0;
+    splits[n++] = 0;
+    for (i=1; i<nthreads; i++) {
+        pos = len / nthreads * i;
+        if (pos <= splits[n-1])
+            pos = splits[n-1] + 1;
+        while (pos < len) {
+            pos++;
+            if (s[pos-1] == '\n' && pos < len && _charType((unsigned char) s[pos]) == C_WORD)
+                break;
+        }
+        if (pos >= len)
+            break;
+        splits[n++] = pos;
+    }
+
+    for (k=0; k<n; k++) {
+        chunk[k].p = OgdlParser_new();
+        if (!chunk[k].p) { n = k; break; }
+        chunk[k].p->src_type = SRC_STRING;
+        chunk[k].p->in = (unsigned char *) s;
+        chunk[k].p->in_pos = splits[k];
+        chunk[k].p->in_len = len;
+        chunk[k].splits = splits;
+        chunk[k].nsplits = n;
+        chunk[k].next = k + 1;
+        chunk[k].stop = -1;
+        chunk[k].orphan = 0;
+        chunk[k].nerrors = 0;
+        if (k) {
+            chunk[k].p->src = &chunk[k];
+            chunk[k].p->errorHandler = (void *) chunkError;
+        }
+
+        /* quoted() uses the indentation of the node level, which may
+           have been set by lines before the split */
+        if (k)
+            for (i=1; i<LEVELS; i++)
+                chunk[k].p->indentation[i] = -1;
+    }
+
+    for (k=1; k<n; k++)
+        if (pthread_create(&th[k],0,parseChunk,&chunk[k]))
+            break;
+    if (n)
+        parseChunk(&chunk[0]);
+    for (i=1; i<k; i++)
+        pthread_join(th[i],0);
+    for (; k<n; k++)                /* threads that could not be started */
+        parseChunk(&chunk[k]);
+
+    /* follow the chain of chunks from the first one, keeping track of
+       the indentation levels and tabs the serial parser would have at
+       each split. The chunk where a parser stopped is used if the
+       levels it took as 0 are 0, if it set up its tabs as the ones
+       before it did (else the serial parser would have stopped there
+       with an error), and if all its nodes found a parent in it (the
+       serial parser adds a node after a comment to the last one of its
+       level, from any line before). If not, this chunk's parser goes
+       on to the next split. Line numbers go on from the line where the
+       parser before stopped, counted as the serial parser does. */
+
+    if (n)
+        g = Graph_new("__root__");
+
+    for (j=0; j<LEVELS; j++)
+        indent[j] = 0;
+
+    tabs = -1;
+    line0 = 0;
+    for (k=0; k<n && g; k=i) {
+        for (;;) {
+            i = chunk[k].stop;
+            if (chunk[k].p->tabs != -1)
+                tabs = chunk[k].p->tabs;
+            for (j=0; j<LEVELS; j++)
+                if (chunk[k].p->indentation[j] >= 0)
+                    indent[j] = chunk[k].p->indentation[j];
+            if (i < 0)
+                break;
+            for (j=0; j<LEVELS; j++)
+                if (chunk[i].p->inherited[j] && indent[j])
+                    break;
+            if (j == LEVELS && !chunk[i].orphan && (tabs == -1
+                || chunk[i].p->tabs == -1 || chunk[i].p->tabs == tabs))
+                break;
+
+            /* past the split the levels it did not set are those of
+               the lines before, not 0 */
+            for (j=0; j<LEVELS; j++)
+                if (chunk[k].p->indentation[j] < 0)
+                    chunk[k].p->indentation[j] = indent[j];
+            chunk[k].next = i + 1;
+            parseChunk(&chunk[k]);
+        }
+        splice(g,chunk[k].p);
+
+        for (j=0; j<chunk[k].nerrors; j++) {
+            chunk[k].p->line = line0 + chunk[k].error_line[j];
+            OgdlParser_error(chunk[k].p,chunk[k].error[j]);
+        }
+        line0 += chunk[k].line;
+
+        if (i < 0)
+            break;
+    }
+
+    for (k=0; k<n; k++) {
+        chunk[k].p->in = 0;
+        OgdlParser_free(chunk[k].p);
+    }
+
+    free(splits);
+    free(chunk);
+    free(th);
+    munmap(s,len);
+
+    /* same as Ogdl_load() for a file without nodes */
+    if (g && !g->size) {
+        Graph_free(g);
+        g = 0;
+    }
+    return g;
+#endif
+}
@@ -5,13 +5,16 @@
     Grammar:
 
         path :  e1(.e)*
-        e : s arglist? | [path?] | {path?}
+        e : s arglist? | [path?] | {path?} | '*' | '**'
         e1 : s arglist?
         s : char_word+ | single_quoted | double_quoted
         arglist : '(' (path space? ',' space)* path? ')'
         char_word : any printable char less separators []{};., and space
         
         
+    OgdlPath_compile() parses a path once into an OgdlPath, a list of
+    steps, to be evaluated with OgdlPath_eval() (graph.c).
+
     PENDING:    
     
     - escape sequences \' \"
@@ -96,3 +99,333 @@ int isWordChar ( char c )
     }
 }
 
+
+/* Reads the steps of a path. With p == NULL it only counts them, and
+   the bytes their names take, in *nsteps and *nbytes.
+
+   A name followed by [n] or [] is one step (PATH_NTH or PATH_ALL); an
+   index after a dot or at the start is PATH_INDEX. * and ** (not
+   quoted) are PATH_ANY and PATH_DESC, with no name; an index after them
+   is a step of its own. Names can be quoted with ' or " (without escape
+   sequences). Returns -1 on a syntax error.
+*/
+
+static int steps(const char *path, OgdlPath p, int *nsteps, int *nbytes)
+{
+    const char *s = path, *b;
+    OgdlPathStep *st = 0;
+    int n = 0, bytes = 0, named = 0, len, q;
+    long i;
+
+    while (*s) {
+        if (*s == '.') {
+            named = 0;
+            s++;
+            continue;
+        }
+
+        if (*s == '[') {
+            s++;
+            if (*s == ']' || !*s) {
+                if (!named) return -1;      /* [] needs a name */
+                if (p) st->type = PATH_ALL;
+                if (*s) s++;
+                named = 0;
+                continue;
+            }
+            for (i=0; *s >= '0' && *s <= '9'; s++) {
+                i = i*10 + (*s - '0');
+                if (i > 0x7fffffff) return -1;
+            }
+            if (*s == ']')
+                s++;
+            else if (*s)
+                return -1;
+
+            if (named) {
+                if (p) {
+                    st->type = PATH_NTH;
+                    st->n = i;
+                }
+            }
+            else {
+                if (p) {
+                    st = p->steps + n;
+                    st->type = PATH_INDEX;
+                    st->n = i;
+                    st->name = 0;
+                    st->len = 0;
+                    st->hash = 0;
+                    st->sym = 0;
+                }
+                n++;
+            }
+            named = 0;
+            continue;
+        }
+
+        if (named) return -1;           /* two names without a dot */
+
+        if (*s == '*' && (!isWordChar(s[1]) || (s[1] == '*' && !isWordChar(s[2])))) {
+            len = s[1] == '*' ? 2 : 1;
+            if (p) {
+                st = p->steps + n;
+                st->type = len == 1 ? PATH_ANY : PATH_DESC;
+                st->n = 0;
+                st->name = 0;
+                st->len = 0;
+                st->hash = 0;
+                st->sym = 0;
+            }
+            n++;
+            s += len;
+            continue;
+        }
+
+        if (*s == '\'' || *s == '"') {
+            q = *s++;
+            for (b = s; *s && *s != q; s++)
+                ;
+            if (!*s) return -1;
+            len = s - b;
+            s++;
+        }
+        else {
+            for (b = s; *s && isWordChar(*s); s++)
+                ;
+            len = s - b;
+        }
+        if (!len) return -1;
+
+        if (p) {
+            st = p->steps + n;
+            st->type = PATH_NAME;
+            st->n = 0;
+            st->name = p->names + bytes;
+            st->len = len;
+            memcpy(st->name,b,len);
+            st->name[len] = 0;
+            st->hash = 0;
+            st->sym = 0;
+        }
+        n++;
+        bytes += len + 1;
+        named = 1;
+    }
+
+    *nsteps = n;
+    *nbytes = bytes;
+    return 0;
+}
+
+/* the path, its steps (at most n) and its names in one block */
+
+static OgdlPath compile(const char *path, void *buf, int n)
+{
+    OgdlPath p = buf;
+    int bytes;
+
+    p->steps = (OgdlPathStep *) (p + 1);
+    p->names = (char *) (p->steps + n);
+    p->symtab = 0;
+    if (steps(path,p,&p->nsteps,&bytes))
+        return 0;
+
+    return p;
+}
+
+/** Compiles a path, to be evaluated any number of times with
+    OgdlPath_eval() without parsing it again. Names have no length
+    limit. Returns NULL if the path is not valid (arglists and {} are
+    not supported) or out of memory.
+ */
+
+OgdlPath OgdlPath_compile (const char *path)
+{
+    OgdlPath p;
+    int i, n, bytes;
+
+    if (!path || steps(path,0,&n,&bytes))
+        return 0;
+
+    p = malloc(sizeof(*p) + n * sizeof(OgdlPathStep) + bytes);
+    if (!p) return 0;
+
+    compile(path,p,n);
+
+    /* hashes of the names, for the indexes of wide nodes (a path
+       compiled for one use computes them only if needed) */
+    for (i=0; i<p->nsteps; i++)
+        if (p->steps[i].name)
+            p->steps[i].hash = OgdlSymtab_hash(p->steps[i].name,p->steps[i].len);
+
+    return p;
+}
+
+/** OgdlPath_compile() into size bytes at buf, which must be aligned as
+    for malloc(). Returns NULL if the path is not valid or does not fit.
+    The path is not to be freed.
+ */
+
+OgdlPath OgdlPath_compileIn (const char *path, void *buf, size_t size)
+{
+    const char *s;
+    int n = 1, bytes;
+
+    if (!path) return 0;
+
+    /* at most one step per '.' or '[', and a NUL per step */
+    for (s = path; *s; s++)
+        if (*s == '.' || *s == '[')
+            n++;
+    bytes = (s - path) + n;
+
+    if (sizeof(struct _OgdlPath) + n * sizeof(OgdlPathStep) + bytes > size)
+        return 0;
+
+    return compile(path,buf,n);
+}
+
+/** Interns the names of the path in t, so that OgdlPath_eval() compares
+    them by pointer with the names of a graph interned in t.
+    Returns 0, or ERROR_malloc.
+ */
+
+int OgdlPath_intern (OgdlPath p, OgdlSymtab t)
+{
+    OgdlPathStep *st;
+    int i;
+
+    for (i=0; i<p->nsteps; i++) {
+        st = p->steps + i;
+        if (!st->name || st->len > SYMBOL_MAX)
+            continue;               /* never interned in a graph */
+        st->sym = OgdlSymtab_intern(t,st->name,st->len);
+        if (!st->sym) return ERROR_malloc;
+    }
+    p->symtab = t;
+    return 0;
+}
+
+/** OgdlPath destructor */
+
+void OgdlPath_free (OgdlPath p)
+{
+    free(p);
+}
+
+/* a step in the trie of a path set, the same as s */
+
+static int sameStep(OgdlPathStep *a, OgdlPathStep *s)
+{
+    if (a->type != s->type || a->n != s->n)
+        return 0;
+    if (!a->name)
+        return 1;
+    return a->len == s->len && !memcmp(a->name,s->name,s->len);
+}
+
+/* the child of trie node t for step s, added if not there */
+
+static int trieChild(OgdlPathSet set, int t, OgdlPathStep *s)
+{
+    struct _OgdlPathTrie *x;
+    int c, last = -1;
+
+    for (c = set->trie[t].first; c >= 0; c = set->trie[c].next) {
+        if (sameStep(&set->trie[c].step,s))
+            return c;
+        last = c;
+    }
+
+    if (set->ntrie == set->trie_max) {
+        x = realloc(set->trie,set->trie_max * 2 * sizeof(*x));
+        if (!x) return -1;
+        set->trie = x;
+        set->trie_max *= 2;
+    }
+
+    c = set->ntrie++;
+    x = set->trie + c;
+    x->step = *s;
+    x->first = x->next = -1;
+    x->path = -1;
+    x->nchildren = 0;
+    if (last >= 0)
+        set->trie[last].next = c;
+    else
+        set->trie[t].first = c;
+    set->trie[t].nchildren++;
+
+    return c;
+}
+
+/** Compiles n paths into a set, for Graph_getMany(). The paths are
+    merged into a trie, so that common prefixes are resolved once.
+    Returns NULL if a path is not valid or uses name[], * or **.
+ */
+
+OgdlPathSet OgdlPathSet_new (char **paths, int n)
+{
+    OgdlPathSet set;
+    OgdlPath p;
+    int i, k, t;
+
+    set = malloc(sizeof(*set));
+    if (!set) return 0;
+
+    set->npaths = n;
+    set->paths = calloc(n ? n : 1,sizeof(OgdlPath));
+    set->next_path = malloc((n ? n : 1) * sizeof(int));
+    set->trie_max = 16;
+    set->trie = malloc(set->trie_max * sizeof(struct _OgdlPathTrie));
+    set->ntrie = 1;
+    if (!set->paths || !set->next_path || !set->trie) {
+        OgdlPathSet_free(set);
+        return 0;
+    }
+
+    /* trie node 0 is where all paths start */
+    set->trie[0].first = set->trie[0].next = -1;
+    set->trie[0].path = -1;
+    set->trie[0].nchildren = 0;
+
+    for (i=0; i<n; i++) {
+        p = set->paths[i] = OgdlPath_compile(paths[i]);
+        if (!p) {
+            OgdlPathSet_free(set);
+            return 0;
+        }
+
+        for (t=0, k=0; k<p->nsteps; k++) {
+            if (p->steps[k].type >= PATH_ALL ||
+                (t = trieChild(set,t,p->steps + k)) < 0) {
+                OgdlPathSet_free(set);
+                return 0;
+            }
+        }
+
+        /* paths that end at the same trie node are chained */
+        set->next_path[i] = set->trie[t].path;
+        set->trie[t].path = i;
+    }
+
+    return set;
+}
+
+/** OgdlPathSet destructor */
+
+void OgdlPathSet_free (OgdlPathSet set)
+{
+    int i;
+
+    if (!set) return;
+
+    if (set->paths)
+        for (i=0; i<set->npaths; i++)
+            OgdlPath_free(set->paths[i]);
+    free(set->paths);
+    free(set->next_path);
+    free(set->trie);
+    free(set);
+}
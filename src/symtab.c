@@ -0,0 +1,149 @@
+/** \file symtab.c
+
+    OgdlSymtab: a table of interned strings. There is one copy of each
+    string, so nodes that have the same name share it, and two names
+    from the same table are equal if their pointers are.
+
+    Interning changes the table and is not locked. Once built, the table
+    can be read (OgdlSymtab_lookup()) from several threads.
+*/
+
+#include "ogdl.h"
+
+#define SYMTAB_SIZE 1024    /* initial number of slots, a power of 2 */
+
+/** The hash function of the table (FNV-1a, 32 bits) */
+
+unsigned long OgdlSymtab_hash (const char *s, int len)
+{
+    unsigned long h = 2166136261UL;
+    int i;
+
+    for (i=0; i<len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619UL;
+    }
+    return h & 0xffffffffUL;
+}
+
+/** Symbol table constructor */
+
+OgdlSymtab OgdlSymtab_new (void)
+{
+    OgdlSymtab t;
+
+    t = malloc(sizeof(*t));
+    if (!t) return 0;
+
+    t->slots = calloc(SYMTAB_SIZE,sizeof(t->slots[0]));
+    t->arena = OgdlArena_new(0);
+    if (!t->slots || !t->arena) {
+        free(t->slots);
+        OgdlArena_free(t->arena);
+        free(t);
+        return 0;
+    }
+    t->size = SYMTAB_SIZE;
+    t->count = 0;
+
+    return t;
+}
+
+/* the slot of s, or the empty slot where it goes */
+
+static struct _OgdlSym * slot(OgdlSymtab t, const char *s, int len, unsigned long h)
+{
+    struct _OgdlSym *e;
+    size_t i = h & (t->size - 1);
+
+    for (;;) {
+        e = t->slots + i;
+        if (!e->name)
+            return e;
+        if (e->hash == h && e->len == len && !memcmp(e->name,s,len))
+            return e;
+        i = (i + 1) & (t->size - 1);
+    }
+}
+
+static int grow(OgdlSymtab t)
+{
+    struct _OgdlSym *old = t->slots, *e;
+    size_t i, n = t->size;
+
+    t->slots = calloc(n*2,sizeof(t->slots[0]));
+    if (!t->slots) {
+        t->slots = old;
+        return ERROR_malloc;
+    }
+    t->size = n*2;
+
+    for (i=0; i<n; i++)
+        if (old[i].name) {
+            e = slot(t,old[i].name,old[i].len,old[i].hash);
+            *e = old[i];
+        }
+
+    free(old);
+    return 0;
+}
+
+/** Returns the interned copy of the len bytes at s, adding it to the
+    table if it is not there. NULL if out of memory.
+ */
+
+char * OgdlSymtab_intern (OgdlSymtab t, const char *s, int len)
+{
+    struct _OgdlSym *e;
+    unsigned long h;
+
+    if (!t || !s) return 0;
+
+    h = OgdlSymtab_hash(s,len);
+    e = slot(t,s,len,h);
+    if (e->name)
+        return e->name;
+
+    /* keep the load under 3/4 */
+    if ((t->count+1) * 4 > t->size * 3) {
+        if (grow(t)) return 0;
+        e = slot(t,s,len,h);
+    }
+
+    e->name = OgdlArena_strdup(t->arena,s,len);
+    if (!e->name) return 0;
+    e->hash = h;
+    e->len = len;
+    t->count++;
+
+    return e->name;
+}
+
+/** Returns the interned copy of the string s, or NULL if it is not in
+    the table (and so no interned name is equal to it).
+ */
+
+char * OgdlSymtab_lookup (OgdlSymtab t, const char *s)
+{
+    struct _OgdlSym *e;
+    int len;
+
+    if (!t || !s) return 0;
+
+    len = strlen(s);
+    e = slot(t,s,len,OgdlSymtab_hash(s,len));
+    return e->name;
+}
+
+/** Symbol table destructor. The nodes that use its strings must be
+    freed before.
+ */
+
+void OgdlSymtab_free (OgdlSymtab t)
+{
+    if (!t) return;
+
+    free(t->slots);
+    OgdlArena_free(t->arena);
+    free(t);
+}
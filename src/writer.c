@@ -0,0 +1,989 @@
+/** \file writer.c
+
+    Graph printers that render into a buffer: Graph_fprint() and
+    Graph_print() write it to a FILE in large blocks, Graph_writeFd()
+    to a file descriptor and Graph_toBuffer() keeps it in memory.
+    The output is the same as that of Graph_fprintString() node by
+    node, without a call per character.
+
+    Graph_writeParallel() renders parts of the graph in several threads
+    and writes them in order. FrozenGraph_fprint() prints a FrozenGraph
+    as Graph_fprint() prints the graph it was made of.
+
+    OgdlBin_write() and OgdlBin_toBuffer() write binary OGDL with the
+    same buffer, and OgdlBin_writeIndexed() with an index of subtrees.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "ogdl.h"
+
+#define WRITE_BUFFER 65536  /* bytes written at a time to a FILE or fd */
+
+#define HAS_SPACE   1       /* ' ' or '\t' */
+#define HAS_BREAK   2       /* '\n' or '\r' */
+
+#define UNITS_PER_THREAD  16    /* Graph_writeParallel() splits the graph */
+#define CHUNKS_PER_THREAD 64    /* into at least this many parts, and */
+#define WINDOW_PER_THREAD 4     /* renders this many ahead of the writer */
+
+typedef struct _Writer {
+    char * buf;
+    size_t len;
+    size_t size;
+    FILE * fp;          /* the buffer is written to fp or fd when full, */
+    int    fd;          /* or grows if fp is NULL and fd is -1 */
+    int    error;
+    size_t done;        /* bytes written out before buf */
+} Writer;
+
+static int writeAll(int fd, const char *s, size_t n)
+{
+    long i;
+
+    while (n) {
+        i = write(fd,s,n);
+        if (i < 0 && errno == EINTR)
+            continue;
+        if (i <= 0)
+            return ERROR_write;
+        s += i;
+        n -= i;
+    }
+    return 0;
+}
+
+static void flush(Writer *w)
+{
+    if (!w->len || w->error) {
+        w->len = 0;
+        return;
+    }
+    if (w->fp) {
+        if (fwrite(w->buf,1,w->len,w->fp) != w->len)
+            w->error = ERROR_write;
+    }
+    else
+        w->error = writeAll(w->fd,w->buf,w->len);
+    w->done += w->len;
+    w->len = 0;
+}
+
+/* room for n more bytes: the buffer is flushed or grows. With a FILE
+   or fd, n must not be more than w->size. */
+
+static int reserve(Writer *w, size_t n)
+{
+    char *b;
+    size_t size;
+
+    if (w->len + n <= w->size)
+        return 1;
+
+    if (w->fp || w->fd >= 0) {
+        flush(w);
+        return !w->error;
+    }
+
+    for (size = w->size ? w->size : 4096; size < w->len + n; size *= 2)
+        ;
+    b = realloc(w->buf,size);
+    if (!b) {
+        w->error = ERROR_realloc;
+        return 0;
+    }
+    w->buf = b;
+    w->size = size;
+    return 1;
+}
+
+static void put(Writer *w, const char *s, size_t n)
+{
+    /* what does not fit in the buffer of a FILE or fd goes directly */
+    if ((w->fp || w->fd >= 0) && n > w->size - w->len) {
+        flush(w);
+        if (n >= w->size) {
+            if (w->error) return;
+            if (w->fp)
+                w->error = fwrite(s,1,n,w->fp) == n ? 0 : ERROR_write;
+            else
+                w->error = writeAll(w->fd,s,n);
+            w->done += n;
+            return;
+        }
+    }
+    if (!reserve(w,n)) return;
+    memcpy(w->buf + w->len,s,n);
+    w->len += n;
+}
+
+static void putChar(Writer *w, int c)
+{
+    if (!reserve(w,1)) return;
+    w->buf[w->len++] = c;
+}
+
+static void putSpaces(Writer *w, size_t n)
+{
+    size_t k;
+
+    while (n) {
+        k = n < WRITE_BUFFER ? n : WRITE_BUFFER;
+        if (!reserve(w,k)) return;
+        memset(w->buf + w->len,' ',k);
+        w->len += k;
+        n -= k;
+    }
+}
+
+/* scan(): the length of s, and in *flags whether it has HAS_SPACE or
+   HAS_BREAK characters, in one pass */
+
+#if defined(__GNUC__) && defined(__SSE2__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+
+#include <emmintrin.h>
+
+/* 16 bytes at a time with aligned loads, which do not cross a page
+   boundary and so do not fault after the NUL (but sanitizers see the
+   bytes read past it, so they get the loop below) */
+
+static size_t scan(const char *s, int *flags)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    const char *p = (const char *) ((size_t) s & ~(size_t) 15);
+    unsigned z, a, b, m = 0xffffu << (s - p);
+    __m128i x;
+    int f = 0;
+
+    for (;; p += 16, m = 0xffff) {
+        x = _mm_load_si128((const __m128i *) p);
+        z = _mm_movemask_epi8(_mm_cmpeq_epi8(x,zero)) & m;
+        a = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x,sp),_mm_cmpeq_epi8(x,tab))) & m;
+        b = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x,nl),_mm_cmpeq_epi8(x,cr))) & m;
+        if (z) {
+            m = (z & -z) - 1;   /* the bytes before the NUL */
+            a &= m;
+            b &= m;
+        }
+        if (a) f |= HAS_SPACE;
+        if (b) f |= HAS_BREAK;
+        if (z)
+            break;
+    }
+    *flags = f;
+    return p + __builtin_ctz(z) - s;
+}
+
+#else
+
+static size_t scan(const char *s, int *flags)
+{
+    const unsigned char *p = (const unsigned char *) s;
+    int f = 0;
+
+    for (; *p; p++)
+        if (*p <= ' ') {
+            if (*p == ' ' || *p == '\t')
+                f |= HAS_SPACE;
+            else if (*p == '\n' || *p == '\r')
+                f |= HAS_BREAK;
+        }
+    *flags = f;
+    return (const char *) p - s;
+}
+
+#endif
+
+/* scan() of the len bytes of a binary name: a 0 counts as a space, so
+   that it is written as a block */
+
+static void scanBytes(const char *s, size_t len, int *flags)
+{
+    const unsigned char *p = (const unsigned char *) s, *end = p + len;
+    int f = 0;
+
+    for (; p < end; p++)
+        if (*p <= ' ') {
+            if (*p == '\n' || *p == '\r')
+                f |= HAS_BREAK;
+            else if (*p == ' ' || *p == '\t' || !*p)
+                f |= HAS_SPACE;
+        }
+    *flags = f;
+}
+
+static int putText(Writer *w, const char *s, size_t len, int flags, int indent, int pending_break);
+
+/* Graph_fprintString() into w */
+
+static int putString(Writer *w, const char *s, int indent, int pending_break)
+{
+    size_t len;
+    int flags;
+
+    if (!s) return 0;
+
+    len = scan(s,&flags);
+    return putText(w,s,len,flags,indent,pending_break);
+}
+
+/* putString() of the name of g, all the bytes of a binary one */
+
+static int putName(Writer *w, Graph g, int indent, int pending_break)
+{
+    int flags;
+
+    if (!(g->flags & GRAPH_BINARY))
+        return putString(w,g->name,indent,pending_break);
+
+    scanBytes(g->name,g->len,&flags);
+    return putText(w,g->name,g->len,flags,indent,pending_break);
+}
+
+static int putText(Writer *w, const char *s, size_t len, int flags, int indent, int pending_break)
+{
+    const char *e, *end;
+
+    if (flags) {
+        if (indent > 0) {
+            if (pending_break)
+                putChar(w,'\n');
+            putSpaces(w,indent);
+            put(w,"\\\n",2);
+        }
+
+        indent += 2;
+
+        /* each line indented, but for an empty one after a last '\n' */
+        putSpaces(w,indent);
+        for (end = s + len; s < end; s = e) {
+            e = memchr(s,'\n',end - s);
+            e = e ? e + 1 : end;
+            put(w,s,e - s);
+            if (e < end)
+                putSpaces(w,indent);
+        }
+        if (end[-1] != '\n')
+            putChar(w,'\n');
+
+        return 0;
+    }
+
+    /* most names: the line in one piece */
+    if (len + indent < WRITE_BUFFER && reserve(w,len + indent + 1)) {
+        if (pending_break)
+            w->buf[w->len++] = '\n';
+        memset(w->buf + w->len,' ',indent);
+        memcpy(w->buf + w->len + indent,s,len);
+        w->len += indent + len;
+        return 1;
+    }
+
+    if (pending_break)
+        putChar(w,'\n');
+    putSpaces(w,indent);
+    put(w,s,len);
+
+    return 1;
+}
+
+static int putGraph(Writer *w, Graph g, int level, int maxLevel, int nspaces, int pending_break)
+{
+    int i, j;
+
+    if ((maxLevel != -1) && (level >= maxLevel)) return pending_break;
+
+    if (!g) return 0;
+
+    j = putName(w,g,level * nspaces,pending_break);
+
+    for (i=0; i<g->size && !w->error; i++)
+        j = putGraph(w,g->nodes[i],level+1,maxLevel,nspaces,j);
+
+    return j;
+}
+
+static void writeGraph(Writer *w, Graph g, int max, int nspaces, int mode)
+{
+    int i, j=0;
+
+    if (mode)
+        for (i=0; i<g->size; i++)
+            j = putGraph(w,g->nodes[i],0,max,nspaces,j);
+    else
+        j = putGraph(w,g,0,max,nspaces,j);
+
+    if (j)
+        putChar(w,'\n');
+}
+
+/** Prints a Graph in OGDL format.
+ */
+
+void Graph_print (Graph g)
+{
+    Graph_fprint(g,stdout,-1,4,1);
+}
+
+/** Prints g to fp: all of it (mode 0) or its subnodes (mode 1), up to
+    max levels (-1: all), indenting nspaces per level.
+ */
+
+void Graph_fprint (Graph g, FILE *fp, int max, int nspaces, int mode)
+{
+    char buf[WRITE_BUFFER];
+    Writer w;
+
+    if (!g) return;
+
+    w.buf = buf;
+    w.len = 0;
+    w.size = sizeof(buf);
+    w.fp = fp;
+    w.fd = -1;
+    w.error = 0;
+    w.done = 0;
+
+    writeGraph(&w,g,max,nspaces,mode);
+    flush(&w);
+}
+
+/* putGraph() of node n of f; names are printed as binary ones, all
+   their len bytes */
+
+static int putFrozen(Writer *w, FrozenGraph f, int n, int level, int maxLevel, int nspaces, int pending_break)
+{
+    const char *s;
+    int c, j, flags;
+
+    if ((maxLevel != -1) && (level >= maxLevel)) return pending_break;
+
+    s = f->pool + f->nodes[n].name;
+    scanBytes(s,f->nodes[n].len,&flags);
+    j = putText(w,s,f->nodes[n].len,flags,level * nspaces,pending_break);
+
+    for (c = f->nodes[n].first; c >= 0 && !w->error; c = f->nodes[c].next)
+        j = putFrozen(w,f,c,level+1,maxLevel,nspaces,j);
+
+    return j;
+}
+
+/** Prints node n as Graph_fprint() does */
+
+void FrozenGraph_fprint (FrozenGraph f, int n, FILE *fp, int max, int nspaces, int mode)
+{
+    char buf[WRITE_BUFFER];
+    Writer w;
+    int c, j=0;
+
+    if (!f || n < 0 || n >= f->count) return;
+
+    w.buf = buf;
+    w.len = 0;
+    w.size = sizeof(buf);
+    w.fp = fp;
+    w.fd = -1;
+    w.error = 0;
+    w.done = 0;
+
+    if (mode)
+        for (c = f->nodes[n].first; c >= 0; c = f->nodes[c].next)
+            j = putFrozen(&w,f,c,0,max,nspaces,j);
+    else
+        j = putFrozen(&w,f,n,0,max,nspaces,j);
+
+    if (j)
+        putChar(&w,'\n');
+    flush(&w);
+}
+
+/** Graph_fprint() to a file descriptor. Returns 0, or ERROR_write. */
+
+int Graph_writeFd (Graph g, int fd, int max, int nspaces, int mode)
+{
+    char buf[WRITE_BUFFER];
+    Writer w;
+
+    if (!g) return ERROR_argumentIsNull;
+
+    w.buf = buf;
+    w.len = 0;
+    w.size = sizeof(buf);
+    w.fp = 0;
+    w.fd = fd;
+    w.error = 0;
+    w.done = 0;
+
+    writeGraph(&w,g,max,nspaces,mode);
+    flush(&w);
+    return w.error;
+}
+
+/** Returns what Graph_fprint() prints, NUL terminated, in memory to be
+    freed with free(), and its length in *len if len is not NULL.
+    NULL if out of memory.
+ */
+
+char * Graph_toBuffer (Graph g, int max, int nspaces, int mode, size_t *len)
+{
+    Writer w;
+
+    if (!g) return 0;
+
+    w.buf = 0;
+    w.len = 0;
+    w.size = 0;
+    w.fp = 0;
+    w.fd = -1;
+    w.error = 0;
+    w.done = 0;
+
+    writeGraph(&w,g,max,nspaces,mode);
+    if (reserve(&w,1))
+        w.buf[w.len] = 0;
+
+    if (w.error) {
+        free(w.buf);
+        return 0;
+    }
+    if (len)
+        *len = w.len;
+    return w.buf;
+}
+
+/* Binary OGDL (see ogdlbin.c): the header node, then (level node)*, 0.
+   Levels start at 1, as 0 ends the stream. */
+
+#define BIN_CHUNK WRITE_BUFFER  /* bytes per chunk of a binary node */
+
+/* a multibyte integer: the leading 1 bits of the first byte are the
+   number of bytes that follow, most significant first */
+
+static void putInteger(Writer *w, unsigned long i)
+{
+    static const unsigned char lead[] = { 0, 0x80, 0xc0, 0xe0, 0xf0 };
+    unsigned char b[5];
+    int n, k;
+
+    n = i < 0x80 ? 1 : i < 0x4000 ? 2 : i < 0x200000 ? 3 : i < 0x10000000 ? 4 : 5;
+    for (k=n-1; k>0; k--, i >>= 8)
+        b[k] = i & 0xff;
+    b[0] = lead[n-1] | (n < 5 ? i : 0);
+    put(w,(char *) b,n);
+}
+
+/* binary names, and those that would not read back as text nodes
+   (taken for a binary node or a comment), go as binary nodes */
+
+static void putBinNode(Writer *w, const char *s, size_t len, int binary)
+{
+    size_t n;
+
+    if (!binary && len && s[0] != 1 && s[0] != '#') {
+        put(w,s,len+1);
+        return;
+    }
+
+    putChar(w,1);
+    for (; len; s += n, len -= n) {
+        n = len < BIN_CHUNK ? len : BIN_CHUNK;
+        putInteger(w,n);
+        put(w,s,n);
+    }
+    putChar(w,0);
+}
+
+static void putBin(Writer *w, Graph g, int level)
+{
+    int i;
+
+    putInteger(w,level);
+    putBinNode(w,g->name,Graph_len(g),g->flags & GRAPH_BINARY);
+
+    for (i=0; i<g->size && !w->error; i++)
+        putBin(w,g->nodes[i],level+1);
+}
+
+static void writeBin(Writer *w, Graph g)
+{
+    int i;
+
+    put(w,"\x01G",3);       /* header: level 1, "G" */
+    for (i=0; i<g->size && !w->error; i++)
+        putBin(w,g->nodes[i],1);
+    putChar(w,0);
+}
+
+/** Writes the subnodes of g to fd in binary OGDL, as read back by
+    OgdlBinParser_parse(). Returns 0, or ERROR_write.
+ */
+
+int OgdlBin_write (Graph g, int fd)
+{
+    char buf[WRITE_BUFFER];
+    Writer w;
+
+    if (!g) return ERROR_argumentIsNull;
+
+    w.buf = buf;
+    w.len = 0;
+    w.size = sizeof(buf);
+    w.fp = 0;
+    w.fd = fd;
+    w.error = 0;
+    w.done = 0;
+
+    writeBin(&w,g);
+    flush(&w);
+    return w.error;
+}
+
+/** Returns what OgdlBin_write() writes, in memory to be freed with
+    free(), and its length in *len. NULL if out of memory.
+ */
+
+char * OgdlBin_toBuffer (Graph g, size_t *len)
+{
+    Writer w;
+
+    if (!g) return 0;
+
+    w.buf = 0;
+    w.len = 0;
+    w.size = 0;
+    w.fp = 0;
+    w.fd = -1;
+    w.error = 0;
+    w.done = 0;
+
+    writeBin(&w,g);
+
+    if (w.error) {
+        free(w.buf);
+        return 0;
+    }
+    if (len)
+        *len = w.len;
+    return w.buf;
+}
+
+/* Indexed binary OGDL (see ogdlbin.c): the stream, then a stream with
+   the names of the indexed nodes, their offsets and lengths in the
+   first, and a footer. */
+
+#define POS(w) ((unsigned long long) ((w)->done + (w)->len))
+
+typedef struct _BinIndex {
+    Graph root;                 /* the names of the indexed nodes */
+    unsigned long long *at;     /* offset and length of each, in preorder */
+    long   n;
+    long   max;
+    int    depth;               /* levels indexed */
+} BinIndex;
+
+static void putOffset(Writer *w, unsigned long long i)
+{
+    unsigned char b[8];
+    int k;
+
+    for (k=0; k<8; k++, i >>= 8)
+        b[k] = i & 0xff;
+    put(w,(char *) b,8);
+}
+
+/* putBin() that adds g to the index below parent */
+
+static void putBinIndexed(Writer *w, Graph g, int level, Graph parent, BinIndex *x)
+{
+    unsigned long long start = POS(w), *at;
+    Graph node;
+    long k, n;
+    int i;
+
+    if (level > x->depth) {
+        putBin(w,g,level);
+        return;
+    }
+
+    if (x->n == x->max) {
+        n = x->max ? x->max * 2 : 256;
+        at = realloc(x->at,n * 2 * sizeof(*at));
+        if (!at) {
+            w->error = ERROR_realloc;
+            return;
+        }
+        x->at = at;
+        x->max = n;
+    }
+    k = x->n++;
+
+    /* an empty name is read back as an empty binary node */
+    node = (g->flags & GRAPH_BINARY) || !*g->name ? Graph_newBytes(g->name,Graph_len(g))
+                                                  : Graph_newRef(g->name);
+    if (!node || Graph_addNode(parent,node)) {
+        Graph_free(node);
+        w->error = ERROR_malloc;
+        return;
+    }
+
+    putInteger(w,level);
+    putBinNode(w,g->name,Graph_len(g),g->flags & GRAPH_BINARY);
+
+    for (i=0; i<g->size && !w->error; i++)
+        putBinIndexed(w,g->nodes[i],level+1,node,x);
+
+    x->at[2*k] = start;
+    x->at[2*k+1] = POS(w) - start;
+}
+
+/** Writes the subnodes of g to fd as OgdlBin_write() does, followed by
+    an index of the nodes of the first depth levels (1: the subnodes of
+    g) for OgdlBin_openIndexed() and OgdlBin_getSubtree(). The stream
+    still reads as binary OGDL. Returns 0, or ERROR_write.
+ */
+
+int OgdlBin_writeIndexed (Graph g, int fd, int depth)
+{
+    char buf[WRITE_BUFFER];
+    unsigned long long index_at, table_at;
+    BinIndex x;
+    Writer w;
+    long k;
+    int i;
+
+    if (!g) return ERROR_argumentIsNull;
+
+    if (!(x.root = Graph_new("_index")))
+        return ERROR_malloc;
+    x.at = 0;
+    x.n = x.max = 0;
+    x.depth = depth < 1 ? 1 : depth < LEVELS-2 ? depth : LEVELS-2;
+
+    w.buf = buf;
+    w.len = 0;
+    w.size = sizeof(buf);
+    w.fp = 0;
+    w.fd = fd;
+    w.error = 0;
+    w.done = 0;
+
+    put(&w,"\x01G",3);
+    for (i=0; i<g->size && !w.error; i++)
+        putBinIndexed(&w,g->nodes[i],1,x.root,&x);
+    putChar(&w,0);
+
+    index_at = POS(&w);
+    writeBin(&w,x.root);
+
+    table_at = POS(&w);
+    for (k=0; k<2*x.n; k++)
+        putOffset(&w,x.at[k]);
+
+    putOffset(&w,index_at);
+    putOffset(&w,table_at);
+    putOffset(&w,x.n);
+    put(&w,OGDLBIN_MAGIC,8);
+    flush(&w);
+
+    Graph_free(x.root);
+    free(x.at);
+    return w.error;
+}
+
+#ifndef _WIN32
+
+/* Graph_writeParallel(): the graph is split in units, a node at some
+   level with all below it or only its own line. Consecutive units make
+   a chunk, rendered by one thread into its own buffer. */
+
+typedef struct _WriteUnit {
+    Graph g;
+    int   level;
+    int   line;         /* only the name of g: its subnodes are units */
+} WriteUnit;
+
+typedef struct _WriteChunk {
+    int    first;       /* units */
+    int    n;
+    char * buf;
+    size_t len;
+    int    lead;        /* buf starts with a break owed to the chunk before */
+    int    cut;         /* all its units are beyond max levels */
+    int    j;           /* pending break at the end */
+    int    done;
+    int    error;
+} WriteChunk;
+
+typedef struct _WriteJob {
+    WriteUnit  *units;
+    WriteChunk *chunks;
+    int    nchunks;
+    int    next;        /* chunk to render next */
+    int    written;     /* chunks written */
+    int    window;
+    int    max;
+    int    nspaces;
+    int    stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} WriteJob;
+
+/* whether putName() starts with the pending break */
+
+static int leads(Graph g, int indent)
+{
+    int flags;
+
+    if (g->flags & GRAPH_BINARY)
+        scanBytes(g->name,g->len,&flags);
+    else
+        scan(g->name,&flags);
+    return !flags || indent > 0;
+}
+
+/* renders a chunk as if a break were pending before it: the first line
+   that takes it says so in lead, and the writer drops it if there was
+   none */
+
+static void renderChunk(WriteJob *job, WriteChunk *c)
+{
+    WriteUnit *u;
+    Writer w;
+    int i, j = 1;
+
+    w.buf = 0;
+    w.len = 0;
+    w.size = 0;
+    w.fp = 0;
+    w.fd = -1;
+    w.error = 0;
+    w.done = 0;
+
+    c->lead = 0;
+    c->cut = 1;
+
+    for (i=0; i<c->n && !w.error; i++) {
+        u = job->units + c->first + i;
+        if (job->max != -1 && u->level >= job->max)
+            continue;               /* j passes through */
+        if (c->cut) {
+            c->lead = leads(u->g,u->level * job->nspaces);
+            c->cut = 0;
+        }
+        if (u->line)
+            j = putName(&w,u->g,u->level * job->nspaces,j);
+        else
+            j = putGraph(&w,u->g,u->level,job->max,job->nspaces,j);
+    }
+
+    c->buf = w.buf;
+    c->len = w.len;
+    c->j = j;
+    c->error = w.error;
+}
+
+static void * writeWorker(void *arg)
+{
+    WriteJob *job = arg;
+    int c;
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        while (!job->stop && job->next < job->nchunks
+               && job->next >= job->written + job->window)
+            pthread_cond_wait(&job->cond,&job->lock);
+        if (job->stop || job->next >= job->nchunks)
+            break;
+        c = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        renderChunk(job,job->chunks + c);
+
+        pthread_mutex_lock(&job->lock);
+        job->chunks[c].done = 1;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return 0;
+}
+
+/* the units of writeGraph(): a unit with subnodes is replaced by its
+   line and a unit per subnode, level by level, until there are at
+   least min of them or none can be split. Returns their number, or -1
+   if out of memory. */
+
+static int units(WriteUnit **pu, Graph g, int max, int mode, int min)
+{
+    WriteUnit *u, *v;
+    int i, k, n, m, split;
+
+    if (mode) {
+        n = g->size;
+        u = malloc((n ? n : 1) * sizeof(WriteUnit));
+        if (!u) return -1;
+        for (i=0; i<n; i++) {
+            u[i].g = g->nodes[i];
+            u[i].level = 0;
+            u[i].line = 0;
+        }
+    }
+    else {
+        n = 1;
+        u = malloc(sizeof(WriteUnit));
+        if (!u) return -1;
+        u[0].g = g;
+        u[0].level = 0;
+        u[0].line = 0;
+    }
+
+    while (n < min) {
+        for (m=n, split=0, i=0; i<n; i++)
+            if (!u[i].line && u[i].g && u[i].g->size
+                && (max == -1 || u[i].level + 1 < max)) {
+                m += u[i].g->size;
+                split = 1;
+            }
+        if (!split)
+            break;
+
+        v = malloc(m * sizeof(WriteUnit));
+        if (!v) {
+            free(u);
+            return -1;
+        }
+        for (m=0, i=0; i<n; i++) {
+            v[m++] = u[i];
+            if (u[i].line || !u[i].g || !u[i].g->size
+                || (max != -1 && u[i].level + 1 >= max))
+                continue;
+            v[m-1].line = 1;
+            for (k=0; k<u[i].g->size; k++) {
+                v[m].g = u[i].g->nodes[k];
+                v[m].level = u[i].level + 1;
+                v[m++].line = 0;
+            }
+        }
+        free(u);
+        u = v;
+        n = m;
+    }
+
+    *pu = u;
+    return n;
+}
+
+#endif
+
+/** Graph_writeFd() with nthreads threads (< 1: one per processor)
+    rendering parts of the graph while this one writes them in order.
+    The output is the same. Returns 0, ERROR_write, or ERROR_malloc or
+    ERROR_realloc if out of memory.
+ */
+
+int Graph_writeParallel (Graph g, int fd, int max, int nspaces, int mode, int nthreads)
+{
+#ifdef _WIN32
+    return Graph_writeFd(g,fd,max,nspaces,mode);
+#else
+    WriteJob job;
+    WriteChunk *c;
+    pthread_t *th;
+    int i, k, n, per, nth, j = 0, error = 0;
+
+    if (!g) return ERROR_argumentIsNull;
+
+    if (nthreads < 1)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 2)
+        return Graph_writeFd(g,fd,max,nspaces,mode);
+
+    n = units(&job.units,g,max,mode,nthreads * UNITS_PER_THREAD);
+    if (n < 0) return ERROR_malloc;
+
+    /* consecutive units in chunks */
+    job.nchunks = nthreads * CHUNKS_PER_THREAD;
+    if (job.nchunks > n)
+        job.nchunks = n;
+    per = job.nchunks ? (n + job.nchunks - 1) / job.nchunks : 0;
+    job.nchunks = per ? (n + per - 1) / per : 0;
+
+    job.chunks = calloc(job.nchunks ? job.nchunks : 1,sizeof(WriteChunk));
+    th = malloc(nthreads * sizeof(pthread_t));
+    if (!job.chunks || !th) {
+        free(job.units);
+        free(job.chunks);
+        free(th);
+        return ERROR_malloc;
+    }
+    for (k=0; k<job.nchunks; k++) {
+        job.chunks[k].first = k * per;
+        job.chunks[k].n = k * per + per <= n ? per : n - k * per;
+    }
+
+    job.next = job.written = job.stop = 0;
+    job.window = nthreads * WINDOW_PER_THREAD;
+    job.max = max;
+    job.nspaces = nspaces;
+    pthread_mutex_init(&job.lock,0);
+    pthread_cond_init(&job.cond,0);
+
+    for (nth=0; nth<nthreads; nth++)
+        if (pthread_create(&th[nth],0,writeWorker,&job))
+            break;
+
+    /* write the chunks in order as they are done */
+    for (k=0; k<job.nchunks && !error; k++) {
+        c = job.chunks + k;
+        pthread_mutex_lock(&job.lock);
+        while (!c->done && nth)
+            pthread_cond_wait(&job.cond,&job.lock);
+        pthread_mutex_unlock(&job.lock);
+        if (!nth)
+            renderChunk(&job,c);    /* no thread could be started */
+
+        if (c->error)
+            error = c->error;
+        else if (!c->cut) {
+            i = c->lead && !j;
+            if (c->len > (size_t) i)
+                error = writeAll(fd,c->buf + i,c->len - i);
+            j = c->j;
+        }
+        free(c->buf);
+        c->buf = 0;
+
+        pthread_mutex_lock(&job.lock);
+        job.written++;
+        if (error)
+            job.stop = 1;
+        pthread_cond_broadcast(&job.cond);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    for (i=0; i<nth; i++)
+        pthread_join(th[i],0);
+
+    if (!error && j)
+        error = writeAll(fd,"\n",1);
+
+    for (; k<job.nchunks; k++)
+        free(job.chunks[k].buf);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+    free(job.units);
+    free(job.chunks);
+    free(th);
+    return error;
+#endif
+}
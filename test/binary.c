@@ -0,0 +1,148 @@
+/* binary OGDL reads back empty binary nodes, with what is below them,
+   and leaves out comments with what is below them; FrozenGraph_fprint()
+   prints binary names as Graph_fprint() does */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ogdl.h"
+
+static int failed = 0;
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr,"%s:%d: %s\n",__FILE__,__LINE__,#x); failed++; } } while (0)
+
+/* the subnodes of a and b are the same */
+
+static int sameNodes(Graph a, Graph b)
+{
+    int i;
+
+    if (!a || !b || a->size != b->size)
+        return 0;
+    for (i=0; i<a->size; i++)
+        if (!Graph_equal(a->nodes[i],b->nodes[i]))
+            return 0;
+    return 1;
+}
+
+/* what Graph_fprint() prints of g, or FrozenGraph_fprint() of f,
+   and its length in *n */
+
+static char * printed(Graph g, FrozenGraph f, long *n)
+{
+    FILE *fp = tmpfile();
+    char *s;
+
+    if (!fp) return 0;
+    if (g)
+        Graph_fprint(g,fp,-1,2,1);
+    else
+        FrozenGraph_fprint(f,0,fp,-1,2,1);
+    *n = ftell(fp);
+    rewind(fp);
+    s = calloc(*n + 1,1);
+    if (s && fread(s,1,*n,fp) != (size_t) *n) {
+        free(s);
+        s = 0;
+    }
+    fclose(fp);
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    const char *file = argc > 1 ? argv[1] : "binary.bin";
+    Graph g, r, node, empty;
+    OgdlBinParser p;
+    OgdlBinIndex x;
+    FrozenGraph f;
+    char *buf, *a, *b;
+    size_t len;
+    long n, m;
+    int fd;
+
+    /* _root: a (empty (x), b), empty (y), c\0d (z) */
+    g = Graph_new("_root");
+    node = Graph_add(g,"a");
+    Graph_addNode(node,empty = Graph_newBytes("",0));
+    Graph_add(empty,"x");
+    Graph_add(node,"b");
+    Graph_addNode(g,node = Graph_newBytes("",0));
+    Graph_add(node,"y");
+    Graph_addNode(g,node = Graph_newBytes("c\0d",3));
+    Graph_add(node,"z");
+
+    buf = OgdlBin_toBuffer(g,&len);
+    CHECK(buf);
+    r = OgdlBin_parseBuffer(buf,len);
+    CHECK(sameNodes(g,r));
+    Graph_free(r);
+
+    fd = open(file,O_RDWR | O_CREAT | O_TRUNC,0644);
+    if (fd < 0) return 1;
+    CHECK(OgdlBin_write(g,fd) == 0);
+    lseek(fd,0,SEEK_SET);
+    p = OgdlBinParser_new(0,fd);
+    r = OgdlBinParser_parse(p);
+    CHECK(sameNodes(g,r));
+    OgdlBinParser_free(p);
+
+    /* the subtrees of the empty nodes, and of those after them */
+    CHECK(ftruncate(fd,0) == 0);
+    lseek(fd,0,SEEK_SET);
+    CHECK(OgdlBin_writeIndexed(g,fd,1) == 0);
+    x = OgdlBin_openIndexed(fd);
+    CHECK(x);
+    r = OgdlBin_getSubtree(x,"[1]");
+    CHECK(Graph_equal(r,g->nodes[1]));
+    Graph_free(r);
+    r = OgdlBin_getSubtree(x,"[2]");
+    CHECK(Graph_equal(r,g->nodes[2]));
+    Graph_free(r);
+    r = OgdlBin_getSubtree(x,"a.[0]");
+    CHECK(Graph_equal(r,g->nodes[0]->nodes[0]));
+    Graph_free(r);
+    OgdlBin_closeIndexed(x);
+    close(fd);
+    remove(file);
+
+    /* a comment and what is below it: "Xc" made "#c" in the buffer */
+    r = Graph_new("_root");
+    Graph_add(r,"p");
+    Graph_add(Graph_add(r,"Xc"),"q");
+    Graph_add(Graph_add(r,"d"),"e");
+    free(buf);
+    buf = OgdlBin_toBuffer(r,&len);
+    CHECK(buf);
+    *(char *) memchr(buf,'X',len) = '#';
+    Graph_free(r);
+    r = OgdlBin_parseBuffer(buf,len);
+    CHECK(r && r->size == 2 && !r->nodes[0]->size && r->nodes[1]->size == 1);
+    Graph_free(r);
+
+    fd = open(file,O_RDWR | O_CREAT | O_TRUNC,0644);
+    if (fd < 0) return 1;
+    CHECK(write(fd,buf,len) == (ssize_t) len);
+    lseek(fd,0,SEEK_SET);
+    p = OgdlBinParser_new(0,fd);
+    r = OgdlBinParser_parse(p);
+    CHECK(r && r->size == 2 && !r->nodes[0]->size && r->nodes[1]->size == 1);
+    OgdlBinParser_free(p);
+    close(fd);
+    remove(file);
+
+    f = Graph_freeze(g);
+    a = printed(g,0,&n);
+    b = printed(0,f,&m);
+    CHECK(a && b && n == m && !memcmp(a,b,n));
+    free(a);
+    free(b);
+    FrozenGraph_free(f);
+
+    free(buf);
+    Graph_free(g);
+    return failed != 0;
+}
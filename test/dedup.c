@@ -0,0 +1,150 @@
+/* hashes above a node that was shared by Graph_dedup() follow its
+   changes, whichever of its parents is left; the parser in dedup mode
+   gives the graph Ogdl_load() gives */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ogdl.h"
+
+static int failed = 0;
+
+static void quiet(OgdlParser p, int n)
+{
+    (void) p;
+    (void) n;
+}
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr,"%s:%d: %s\n",__FILE__,__LINE__,#x); failed++; } } while (0)
+
+static unsigned int seed = 1;
+
+static int rnd(int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+/* a random document of few names, with '#word' tokens: the nodes after
+   one go to the last node of their level, in any line before */
+
+static char * randomDoc(int lines)
+{
+    char *s = malloc(lines * 64 + 1), *t = s;
+    int i, k, n, level = 0;
+
+    for (i=0; i<lines; i++) {
+        level = rnd(level + 2);
+        if (level > 5) level = 5;
+        t += sprintf(t,"%*s",level * 2,"");
+        for (k=rnd(3); k>=0; k--)
+            t += sprintf(t,rnd(4) ? "%c%d " : "#%c%d ",'a' + rnd(3),rnd(2));
+        *t++ = '\n';
+    }
+    *t = 0;
+    return s;
+}
+
+/* the graph that s parses to, as text, and with dedup in *shared */
+
+static char * parse(char *s, int dedup, Graph *shared)
+{
+    OgdlParser p = OgdlParser_new();
+    size_t len;
+    char *a;
+
+    OgdlParser_setErrorHandler(p,(void *) quiet);
+    if (dedup)
+        OgdlParser_setDedup(p,1);
+    OgdlParser_parseString(p,s);
+    a = p->g ? Graph_toBuffer(p->g[0],-1,2,1,&len) : strdup("");
+    if (shared && p->g) {
+        *shared = p->g[0];
+        p->g[0] = 0;
+    }
+    OgdlParser_free(p);
+    return a;
+}
+
+/* parent -> child -> grandchild */
+
+static Graph chain(Graph g, char *a, char *b, char *c)
+{
+    Graph n = Graph_add(g,a);
+
+    Graph_add(Graph_add(n,b),c);
+    return n;
+}
+
+int main(void)
+{
+    Graph root, a, b, fresh, fb;
+    OgdlDedup t;
+    int i;
+
+    /* root: a s x, b s x; then a x, b y x */
+    root = Graph_new("root");
+    a = chain(root,"a","s","x");
+    b = chain(root,"b","s","x");
+    CHECK(Graph_dedup(root) == 0);
+    CHECK(a->nodes[0] == b->nodes[0]);
+    Graph_hash(root);
+    Graph_hash(b);
+
+    Graph_set(root,"a",Graph_new("x"));
+    CHECK(Graph_setName(Graph_own(root,"b.s"),"y") == 0);
+
+    fresh = Graph_new("root");
+    Graph_add(Graph_add(fresh,"a"),"x");
+    fb = chain(fresh,"b","y","x");
+    CHECK(Graph_hash(b) == Graph_hash(fb));
+    CHECK(Graph_hash(root) == Graph_hash(fresh));
+    CHECK(Graph_equal(root,fresh));
+    Graph_free(root);
+
+    /* the parent that first had the shared node is freed */
+    root = Graph_new("root");
+    a = chain(root,"a","s","x");
+    b = Graph_new("b");
+    Graph_add(Graph_add(b,"s"),"x");
+    t = OgdlDedup_new();
+    OgdlDedup_intern(t,a->nodes[0],0);
+    OgdlDedup_intern(t,b->nodes[0],0);
+    OgdlDedup_intern(t,a,0);
+    OgdlDedup_intern(t,b,0);
+    OgdlDedup_free(t);
+    CHECK(a->nodes[0] == b->nodes[0]);
+    Graph_hash(b);
+    Graph_free(root);
+
+    CHECK(Graph_setName(Graph_own(b,"s"),"y") == 0);
+    CHECK(Graph_hash(b) == Graph_hash(fb));
+    CHECK(Graph_equal(b,fb));
+
+    Graph_free(b);
+    Graph_free(fresh);
+
+    /* the last nodes are shared too, when the input ends */
+    a = 0;
+    free(parse("a\n  x y\nb\n  x y\n",1,&a));
+    CHECK(a && a->nodes[0]->nodes[0] == a->nodes[1]->nodes[0]);
+    Graph_free(a);
+
+    for (i=0; i<400; i++) {
+        char *doc, *x, *y;
+
+        seed = i + 1;
+        doc = randomDoc(20 + rnd(40));
+        x = parse(doc,0,0);
+        y = parse(doc,1,0);
+        if (strcmp(x,y)) {
+            fprintf(stderr,"dedup parse differs:\n%s",doc);
+            failed++;
+        }
+        free(x);
+        free(y);
+        free(doc);
+    }
+    return failed != 0;
+}
@@ -0,0 +1,208 @@
+/* Ogdl_loadParallel() gives the same graph and prints the same errors
+   as Ogdl_load(), for any number of threads */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ogdl.h"
+
+static unsigned int seed = 1;
+
+static int rnd(int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+static const char sample[] =
+    "host\n"
+    "  network\n"
+    "    eth0\n"
+    "      ip 10.0.0.1\n"
+    "      mask \"255.255.255.0\"\n"
+    "    eth1 down\n"
+    "  name 'a b'\n"
+    "other \"multi\n"
+    "  line quoted\n"
+    "  string\" tail\n"
+    "more\n"
+    "    deep \\\n"
+    "      block line\n"
+    "        indented\n"
+    "last a, b c\n";
+
+/* a random document: nodes, quoted strings and blocks over several
+   lines, at random indentations */
+
+static void randomDoc(FILE *f, int lines)
+{
+    int i, k, n, level = 0;
+
+    for (i=0; i<lines; i++) {
+        level = rnd(level + 2);
+        if (level > 6) level = 6;
+        n = level * (2 + rnd(2));
+        fprintf(f,"%*s",n,"");
+        switch (rnd(6)) {
+        case 0:
+            fprintf(f,"q%d \"first\n",i);
+            for (k=rnd(3); k>=0; k--)
+                fprintf(f,"%*s  line %d\n",n,"",k);
+            fprintf(f,"%*s  end\" after\n",n,"");
+            break;
+        case 1:
+            fprintf(f,"b%d \\\n",i);
+            for (k=rnd(3); k>=0; k--)
+                fprintf(f,"%*s    text %*s%d\n",n,"",rnd(3),"",k);
+            break;
+        case 2:
+            fprintf(f,"g%d x, 'y z' w\n",i);
+            break;
+        default:
+            fprintf(f,"n%d v%d\n",i,rnd(5));
+        }
+    }
+}
+
+/* lines alternating with ones that begin with a comment: the serial
+   parser adds the nodes after it to the last node of their level, in
+   a line before */
+
+static void commentDoc(FILE *f, int lines)
+{
+    int i;
+
+    for (i=0; i<lines; i++)
+        if (i % 2)
+            fprintf(f,"#off%d val%d\n",i,i);
+        else
+            fprintf(f,"rec%d v%d\n",i,i);
+}
+
+/* blocks, whose lines the parser does not count, and lines too deep
+   for it, that it reports */
+
+static void errorDoc(FILE *f, int lines)
+{
+    int i, k;
+
+    for (i=0; i<lines; i++)
+        if (i % 7 == 0)
+            fprintf(f,"b%d \\\n    one\n    two\n",i);
+        else if (i % 101 == 0) {
+            for (k=0; k<LEVELS; k++)
+                fprintf(f,"d%d ",k);
+            fprintf(f,"\n");
+        }
+        else
+            fprintf(f,"n%d v%d\n",i,i);
+}
+
+/* the graph that file loads to with nthreads (0: Ogdl_load()), as
+   text, and what the parser prints (its errors) in *out */
+
+static char * load(const char *file, int nthreads, char **out)
+{
+    char name[1024], *a;
+    long n;
+    size_t len;
+    FILE *f;
+    Graph g;
+    int fd, saved;
+
+    *out = 0;
+    snprintf(name,sizeof(name),"%s.out",file);
+    fflush(stdout);
+    saved = dup(1);
+    fd = open(name,O_RDWR | O_CREAT | O_TRUNC,0644);
+    if (saved < 0 || fd < 0) return 0;
+    dup2(fd,1);
+    close(fd);
+
+    g = nthreads ? Ogdl_loadParallel((char *) file,nthreads) : Ogdl_load((char *) file);
+
+    fflush(stdout);
+    dup2(saved,1);
+    close(saved);
+
+    a = Graph_toBuffer(g,-1,2,1,&len);
+    Graph_free(g);
+
+    if ((f = fopen(name,"r"))) {
+        fseek(f,0,SEEK_END);
+        n = ftell(f);
+        rewind(f);
+        if ((*out = calloc(n + 1,1)) && fread(*out,1,n,f) != (size_t) n)
+            **out = 0;
+        fclose(f);
+    }
+    remove(name);
+    return a;
+}
+
+static int check(const char *file)
+{
+    static const int threads[] = { 1, 2, 3, 4, 5, 7, 8, 16, 17, 64 };
+    char *a, *b, *ea, *eb;
+    int t, bad = 0;
+
+    a = load(file,0,&ea);
+
+    for (t=0; t<(int) (sizeof(threads)/sizeof(threads[0])); t++) {
+        b = load(file,threads[t],&eb);
+        if (!a || !b || strcmp(a,b)) {
+            fprintf(stderr,"%s: differs with %d threads\n",file,threads[t]);
+            bad++;
+        }
+        if (!ea || !eb || strcmp(ea,eb)) {
+            fprintf(stderr,"%s: other errors with %d threads\n",file,threads[t]);
+            bad++;
+        }
+        free(b);
+        free(eb);
+    }
+
+    free(a);
+    free(ea);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    const char *file = argc > 1 ? argv[1] : "parallel.g";
+    FILE *f;
+    int i, bad = 0;
+
+    f = fopen(file,"w");
+    if (!f) return 1;
+    fputs(sample,f);
+    fclose(f);
+    bad += check(file);
+
+    f = fopen(file,"w");
+    if (!f) return 1;
+    commentDoc(f,2000);
+    fclose(f);
+    bad += check(file);
+
+    f = fopen(file,"w");
+    if (!f) return 1;
+    errorDoc(f,2000);
+    fclose(f);
+    bad += check(file);
+
+    for (i=0; i<50; i++) {
+        seed = i + 1;
+        f = fopen(file,"w");
+        if (!f) return 1;
+        randomDoc(f,200 + rnd(400));
+        fclose(f);
+        bad += check(file);
+    }
+
+    remove(file);
+    return bad != 0;
+}
@@ -0,0 +1,145 @@
+/* OgdlParser_feed() fed a few bytes at a time gives the graph that
+   parsing the whole string gives, with blocks, tables and quoted
+   strings inside tables */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ogdl.h"
+
+static int failed = 0;
+
+static void quiet(OgdlParser p, int n)
+{
+    (void) p;
+    (void) n;
+}
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr,"%s:%d: %s\n",__FILE__,__LINE__,#x); failed++; } } while (0)
+
+static unsigned int seed = 1;
+
+static int rnd(int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+/* a random document with a word first on each line (a table or block
+   that opens a line at the top level is not valid) and then words,
+   comments, quoted strings over two lines, and '|' or '\' to end it */
+
+static char * randomDoc(int lines)
+{
+    char *s = malloc(lines * 64 + 1), *t = s;
+    int i, k, level = 0;
+
+    for (i=0; i<lines; i++) {
+        if (rnd(3))
+            level = rnd(4);
+        t += sprintf(t,"%*sw%d ",level * 2 + rnd(2),"",rnd(3));
+        for (k=rnd(3); k>=0; k--)
+            switch (rnd(8)) {
+            case 0:
+                t += sprintf(t,"\"q%d\n%*sr\" ",k,rnd(5),"");
+                break;
+            case 1:
+                *t++ = '|';
+                k = 0;
+                break;
+            case 2:
+                *t++ = '\\';
+                k = 0;
+                break;
+            case 3:
+                t += sprintf(t,"#c ");
+                break;
+            default:
+                t += sprintf(t,"%c%d ",'a' + rnd(3),rnd(3));
+            }
+        *t++ = '\n';
+    }
+    *t = 0;
+    return s;
+}
+
+/* the graph of p, as text; p is freed */
+
+static char * graphOf(OgdlParser p)
+{
+    size_t len;
+    char *a;
+
+    a = p->g && p->g[0] ? Graph_toBuffer(p->g[0],-1,2,1,&len) : strdup("");
+    OgdlParser_free(p);
+    return a;
+}
+
+static char * parse(char *s)
+{
+    OgdlParser p = OgdlParser_new();
+
+    OgdlParser_setErrorHandler(p,(void *) quiet);
+    OgdlParser_parseString(p,s);
+    return graphOf(p);
+}
+
+/* s fed n bytes at a time */
+
+static char * feed(char *s, long n)
+{
+    OgdlParser p = OgdlParser_new();
+    long i, len = strlen(s);
+
+    OgdlParser_setErrorHandler(p,(void *) quiet);
+    for (i=0; i<len; i+=n)
+        if (OgdlParser_feed(p,s+i,i+n < len ? n : len-i))
+            break;
+    OgdlParser_finish(p);
+    return graphOf(p);
+}
+
+/* s parses the same whole and fed in pieces of 1 to 7 bytes */
+
+static int same(char *s)
+{
+    char *x = parse(s), *y;
+    int n, ok = 1;
+
+    for (n=1; ok && n<8; n++) {
+        y = feed(s,n);
+        if (strcmp(x,y)) {
+            fprintf(stderr,"fed %d bytes at a time, differs:\n%s",n,s);
+            ok = 0;
+        }
+        free(y);
+    }
+    free(x);
+    return ok;
+}
+
+int main(void)
+{
+    char *doc, *x;
+    int i;
+
+    /* a block in a table takes the less indented line after it */
+    doc = "  tbl |\n      blk \\\n  tbl |\n";
+    x = feed(doc,3);
+    CHECK(strstr(x,"tbl |"));
+    free(x);
+    CHECK(same(doc));
+
+    /* a quoted string in a table row that goes on less indented */
+    CHECK(same("x\n  y |\n    a \"b\n c\"\n    d\n  z\n"));
+
+    for (i=0; i<400; i++) {
+        seed = i + 1;
+        doc = randomDoc(10 + rnd(20));
+        if (!same(doc))
+            failed++;
+        free(doc);
+    }
+    return failed != 0;
+}
@@ -0,0 +1,115 @@
+/* threads that read a published graph with * and ** paths find what
+   they look for, and do not write to it (run under -fsanitize=thread
+   to see that); then the same with its names index attached, which
+   ** looks up and a change drops */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ogdl.h"
+
+#define HOSTS   100
+#define THREADS 4
+#define ROUNDS  200
+
+static GraphHandle handle;
+static int failed = 0;
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr,"%s:%d: %s\n",__FILE__,__LINE__,#x); \
+                                  __atomic_add_fetch(&failed,1,__ATOMIC_RELAXED); } } while (0)
+
+/* HOSTS hosts with two ports each, under net, with a name */
+
+static Graph hosts(void)
+{
+    Graph g = Graph_new("root"), net, h;
+    char buf[32];
+    int i;
+
+    net = Graph_add(g,"net");
+    for (i=0; i<HOSTS; i++) {
+        sprintf(buf,"host%d",i);
+        h = Graph_add(net,buf);
+        Graph_add(Graph_add(h,"port"),"80");
+        Graph_add(Graph_add(h,"port"),"443");
+        sprintf(buf,"h%d",i);
+        Graph_add(Graph_add(h,"name"),buf);
+    }
+    return g;
+}
+
+static void *reader(void *arg)
+{
+    Graph g, v;
+    int i;
+
+    (void) arg;
+    for (i=0; i<ROUNDS; i++) {
+        g = Graph_acquire(handle);
+
+        v = Graph_get(g,"**.port");
+        CHECK(v && Graph_size(v) == 2 * HOSTS);
+        CHECK(v && Graph_getNode(v,"port"));
+        Graph_free(v);
+
+        v = Graph_get(g,"net.*");
+        CHECK(v && Graph_size(v) == HOSTS);
+        CHECK(v && Graph_getNode(v,"host7"));
+        Graph_free(v);
+
+        v = Graph_get(g,"net.*.name");
+        CHECK(v && Graph_size(v) == HOSTS);
+        Graph_free(v);
+
+        Graph_release(handle,g);
+    }
+    return 0;
+}
+
+static int readAll(Graph g)
+{
+    pthread_t th[THREADS];
+    int i;
+
+    handle = GraphHandle_new(g);
+    if (!handle) return 1;
+
+    for (i=0; i<THREADS; i++)
+        if (pthread_create(&th[i],0,reader,0))
+            return 1;
+    for (i=0; i<THREADS; i++)
+        pthread_join(th[i],0);
+
+    GraphHandle_free(handle);
+    return 0;
+}
+
+int main(void)
+{
+    Graph g, v;
+    OgdlIter it;
+
+    if (readAll(hosts()))
+        return 1;
+
+    g = hosts();
+    if (!g || Graph_setNames(g,Graph_indexNames(g)))
+        return 1;
+    CHECK(Graph_find(g,"**.port",&it) == 0 && it.names);
+    if (readAll(g))
+        return 1;
+
+    /* a change below the root drops the index, and ** sees it */
+    g = hosts();
+    if (!g || Graph_setNames(g,Graph_indexNames(g)))
+        return 1;
+    Graph_add(Graph_get(g,"net.host7"),"port");
+    CHECK(!(g->flags & GRAPH_NAMES));
+    v = Graph_get(g,"**.port");
+    CHECK(v && Graph_size(v) == 2 * HOSTS + 1);
+    Graph_free(v);
+    Graph_free(g);
+
+    return failed != 0;
+}
@@ -7,6 +7,9 @@
 
     - '.' matches the compleet tree, from the base on.
 
+    '*' stands for any node and '**' for any number of levels, so
+    that 'a.*.port' and '**.timeout' print all the nodes that match.
+
     author: Rolf Veen
     first release: 20020902 (see Changelog)
     license: zlib